@@ -12,10 +12,18 @@
 #include "comms/commslib/inc/commsdevice.hpp"
 #include "comms/commslib/inc/message.hpp"
 #include "control/controllib/inc/command.hpp"
+#include "sio/siolib/inc/serialiodevice.hpp"
 #include "system/systemlib/inc/commands.hpp"
 #include "system/systemlib/inc/mcmstates.hpp"
+#include "missionframes.hpp"
+#include "missionstore.hpp"
+#include "rttestimator.hpp"
+#include "targetinfocache.hpp"
+#include "uploadpacer.hpp"
 
 #include <cstdint>
+#include <string>
+#include <vector>
 
 using namespace mercury::embedded;
 
@@ -24,28 +32,66 @@ namespace sapient
     class Mercury
     {
     public:
+        /// Cancellation token for long operations on behalf of a mode. The operation is cancelled when the effective
+        /// mode changes to one which needs different mission content, or to no mode.
+        struct CancellationToken
+        {
+            uint32_t mode {0}; //!< Mode the operation is for
+            uint32_t generation {0}; //!< Mode generation last checked
+            bool cancelled {false};
+        };
+
+        static const uint32_t kHealthCheckPeriodDefault_ms = 5000; //!< Default time, in milliseconds, between target health checks when nothing is changing
+        static const uint32_t kLivenessQuietPeriodDefault_ms = 1000; //!< Default time, in milliseconds, after the last reply before the target is pinged to check it is alive
+        static const int32_t kBaudDefault = 115200; //!< Default serial baud rate
+
+        struct Config
+        {
+            uint32_t healthCheckPeriod_ms {kHealthCheckPeriodDefault_ms}; //!< Time, in milliseconds, between target health checks when nothing is changing
+            uint32_t livenessQuietPeriod_ms {kLivenessQuietPeriodDefault_ms}; //!< Time, in milliseconds, after the last reply before the target is pinged
+            std::vector<int32_t> baudRates {int32_t(kBaudDefault)}; //!< Baud rates to try, fastest first, the next is tried if the target does not respond
+
+            /// Keep several data messages in flight when uploading. Off until confirmed against target firmware, as it
+            /// assumes that the target accepts data messages whilst earlier ones are unacknowledged, acknowledges them
+            /// oldest first and drops the messages which follow a missing one (so all of them are resent after a
+            /// failure). A late acknowledgement to a message which timed out cannot be told apart from the
+            /// acknowledgement to its retransmission.
+            bool windowedUpload {false};
+        };
+
         Mercury();
+        explicit Mercury(Config const &config);
         virtual ~Mercury();
 
         void operator()(std::string port);
         bool ping();
         bool startJamming();
         bool stopJamming();
-        bool sendMission(std::string const &filename);
+        bool sendMission(std::string const &filename, CancellationToken &token);
         bool getMissionName(std::string &name);
 
     private:
         static const uint32_t kMessageTimeout_ms = 2000; //!< Time, in milliseconds, to flush a partially received message from the buffer
-        static const uint32_t kReplyTimeoutDefault_ms = 2500; //!< Time, in milliseconds, to wait for general replies from the target system
-        static const uint32_t kReplyTimeoutCrc_ms = 8100; //!< Time, in milliseconds, to wait for VerifyMissionFileCrcCommand replies from the target system
-        static const uint32_t kInterPacketDelay_ms = 15;//!< Time, in milliseconds, to delay between data/CRC packets
+        static const uint32_t kReplyTimeoutDefault_ms = 2500; //!< Longest time, in milliseconds, to wait for general replies from the target system
+        static const uint32_t kReplyTimeoutCrc_ms = 8100; //!< Longest time, in milliseconds, to wait for VerifyMissionFileCrcCommand replies from the target system
+        static const uint32_t kReplyTimeoutFloor_ms = 50; //!< Shortest time, in milliseconds, to wait for general replies from the target system
+        static const uint32_t kReplyTimeoutDataFloor_ms = 300; //!< Shortest time, in milliseconds, to wait for data message acknowledgements from the target system
+        static const uint32_t kReplyTimeoutUploadFloor_ms = 1000; //!< Shortest time, in milliseconds, to wait for UploadMissionCommand replies from the target system
+        static const uint32_t kReplyTimeoutCrcFloor_ms = 2000; //!< Shortest time, in milliseconds, to wait for VerifyMissionFileCrcCommand replies from the target system
+        static const uint32_t kInterPacketDelay_ms = 15;//!< Time, in milliseconds, to delay before the CRC packet and before retransmitting data packets
         static const uint32_t kWaitReadyTime_ms = 300000; //!< Time, in milliseconds, to wait for system to be ready for mission file
         static const uint32_t kWaitMissionInstallTime_ms = 300000; //!< Time, in milliseconds, to wait for mission to be installed across system
-        static const uint32_t kTimeBetweenPings_ms = 500; //!< Time, in milliseconds, between pings when waiting for system to come online
+        static const uint32_t kInstallPollMin_ms = 250; //!< Shortest time, in milliseconds, between install progress polls
+        static const uint32_t kInstallPollMax_ms = 10000; //!< Longest time, in milliseconds, between install progress polls
+        static const uint32_t kInstallPollDivisor = 2; //!< Install progress is polled again after this fraction of the predicted remaining time
+        static const uint32_t kBaudProbeAttempts = 3; //!< Number of failed attempts to reach the target before the next baud rate is tried
+        static const uint32_t kTimeBetweenPings_ms = 500; //!< Time, in milliseconds, between pings when waiting for system to come online or respond
+        const std::string kInstalledFilePrefix {".installed-"}; //!< Prefix of the file recording the mission installed through each port
         static const int32_t kUartNumber = 0; //!< UART used for comms to target system
-        static const int32_t kReadChunkSize = 253; //!< Read mission file in chunks which fit max message payload size
         static const uint16_t kMinTargetVersionMajor = 6; //!< Minimum target version, major part
         static const uint16_t kMinTargetVersionMinor = 5; //!< Minimum target version, minor part
+        static const uint32_t kUploadWindowSize = 4; //!< Maximum number of unacknowledged data messages in windowed upload mode
+        static const uint32_t kMaxDataRetries = 3; //!< Number of times a data message is retransmitted before the upload is abandoned
 
         enum class state
         {
@@ -53,28 +99,99 @@ namespace sapient
             NoResponse,
             NotReadyForMission,
             ReadyForMission,
+            Idle,
             Jamming
         };
 
+        struct DataMessage
+        {
+            const MissionFrames::Frame *frame; //!< Pre-built message and the mission bytes it carries
+            uint16_t seq;
+            uint32_t retries;
+            uint32_t sent_ms; //!< Time the message was first sent
+            bool resent; //!< Message has been sent more than once so its ack cannot be timed
+        };
+
+        /// Progress of the most recent upload
+        struct UploadProgress
+        {
+            std::string fileName;
+            MissionStore::ContentId contentId;
+            uint16_t nextSeq {0}; //!< Sequence number following the last acknowledged data message
+            int32_t bytesAcked {0};
+            bool interrupted {false}; //!< Upload stopped because the serial link was lost
+        };
+
+        /// Command whose reply carries the command ID, so the reply can be matched to it
+        struct Transaction
+        {
+            system::Command::Id commandId;
+            comms::Message resp;
+            bool complete;
+        };
+
         state m_state{state::SerialDisconnected};
         comms::CommsDevice *m_pCommsDevice{nullptr};
-        uint32_t m_replyTimeout_ms{kReplyTimeoutDefault_ms};
+        sio::SerialIoDevice *m_pSerialIoDevice{nullptr}; //!< Serial device for this controller's port
+        std::string m_port; //!< Serial port device node e.g. /dev/ttyUSB0
+        RttEstimator m_rttQuery{kReplyTimeoutFloor_ms, kReplyTimeoutDefault_ms}; //!< Reply timeout for queries and pings
+        RttEstimator m_rttData{kReplyTimeoutDataFloor_ms, kReplyTimeoutDefault_ms}; //!< Reply timeout for data messages
+        RttEstimator m_rttUpload{kReplyTimeoutUploadFloor_ms, kReplyTimeoutDefault_ms}; //!< Reply timeout for UploadMissionCommand
+        RttEstimator m_rttControl{kReplyTimeoutFloor_ms, kReplyTimeoutDefault_ms}; //!< Reply timeout for commands which change the target's state e.g. StartJamming, StopJamming
+        RttEstimator m_rttCrc{kReplyTimeoutCrcFloor_ms, kReplyTimeoutCrc_ms}; //!< Reply timeout for VerifyMissionFileCrcCommand
+        Config m_config;
+        size_t m_baudIndex{0}; //!< Index of the baud rate in use
+        uint32_t m_lastResponse_ms{0}; //!< Time of the last reply from the target
+        bool m_responseSeen{false}; //!< Target has replied since the connection was established
+        MissionStore::MissionPtr m_loadedMission; //!< Mission most recently installed by us
+        std::string m_loadedMissionName; //!< Name reported by the target for m_loadedMission
+        std::string m_installedFileName; //!< File in which m_loadedMission is persisted
+        uint32_t m_modeGeneration{0}; //!< Generation of the effective mode last acted on
+        base::Version m_targetVersion; //!< Version last reported by the target
+        UploadPacer m_pacer;
+        UploadProgress m_upload;
+        TargetInfoCache m_targetInfo;
+        uint32_t m_dataRetries{0}; //!< Data messages retransmitted since start-up
+        uint32_t m_dataTimeouts{0}; //!< Data messages not acknowledged in time since start-up
 
-        bool waitReadyForMission();
-        bool waitMissionInstall();
-        bool sendMessageGetResponse(const comms::Message& msg, comms::Message& resp);
-        bool sendMessageCheckOk(const comms::Message& msg);
+        void reconcile(uint32_t mode);
+        bool queryTarget(bool missionName);
+        void checkHealth(uint32_t mode);
+        bool waitReadyForMission(CancellationToken &token);
+        bool waitMissionInstall(CancellationToken &token);
+        CancellationToken makeCancellationToken(uint32_t mode);
+        bool isCancelled(CancellationToken &token);
+        bool sendMessageGetResponse(const comms::Message& msg, comms::Message& resp, RttEstimator &rtt);
+        bool receiveResponse(comms::Message& resp, uint32_t timeout_ms);
+        void flushMessages();
+        bool isLinkUp();
+        bool isRecentlyAlive();
+        int32_t baud() const;
         bool sendCommandGetResponse(system::Command::Id cmdId, comms::Message& resp);
-        bool sendCommandGetResponse(const control::Command& cmd, comms::Message& resp);
+        static Transaction makeTransaction(system::Command::Id cmdId);
+        bool transact(std::vector<Transaction> &transactions, RttEstimator &rtt);
+        static bool getResponseId(const comms::Message& msg, uint32_t &responseId);
+        bool sendCommandGetResponse(const control::Command& cmd, comms::Message& resp, RttEstimator &rtt);
         bool sendCommandCheckOk(system::Command::Id cmdId);
-        bool sendCommandCheckOk(const control::Command& cmd);
+        bool sendCommandCheckOk(const control::Command& cmd, RttEstimator &rtt);
         bool isOkResponse(const comms::Message& msg);
-        bool sendCommandCheckResponse(system::Command::Id cmdId);
-        bool isInstallComplete(uint8_t &percent);
+        bool sendCommandCheckResponse(system::Command::Id cmdId, RttEstimator &rtt);
+        /// @param percent Installation progress, only updated if the target replied
+        /// @param replied False if the target did not reply, so nothing is known about progress
+        bool isInstallComplete(uint8_t &percent, bool &replied);
         system::McmState::State getTargetState();
+        system::McmState::State parseTargetState(const comms::Message& msg);
+        bool parseMissionName(const comms::Message& msg, std::string &name);
         bool getTargetVersion(base::Version& vers);
         bool checkTargetVersion();
-        static void getFileSizeAndCrc(FILE *file, int32_t &size, uint16_t &crc);
+        bool isMissionInstalled(uint32_t mode, std::string const &installedName);
+        void setNoResponse();
+        void logTargetInfoCache();
+
+        /// Log with the serial port as a prefix, so messages from different jammers can be told apart
+        void log(int pri, const char *fmt, ...) const;
+        void readInstalledMission();
+        void writeInstalledMission();
     };
 } /* namespace sapient */
 
@@ -30,6 +30,7 @@ namespace sapient
         static const uint32_t kHeartbeatDuration_ms = 10000;
         static const uint32_t kRegAckWait_ms = 30000;
         static const int32_t kMessageBufferSize = 64 * 1024; // 64 KB message buffer
+        const std::string kTaskSetCompleteRequest {"Complete"}; // Task request which ends a set of tasks
 
         enum class state
         {
@@ -42,6 +43,7 @@ namespace sapient
         void disconnect();
         void sendMessage(SapientMessage &msg);
         static char *getIpString(sockaddr *sa, char *s, size_t maxlen);
+        static std::string getInstallStatus();
 
         state m_state{state::NotConnected};
         char m_messageBuffer[kMessageBufferSize] {0};
@@ -49,6 +51,8 @@ namespace sapient
         int m_sockfd {-1};
         int32_t m_sensorId {0};
         int32_t m_reportId {0};
+        uint32_t m_modeSource {0};
+        uint32_t m_statusRevision {0}; // Jammer status revision last reported
     };
 } /* namespace sapient */
 
@@ -93,6 +93,7 @@ public:
     int32_t m_reportId {0};
     std::string m_system {"OK"};
     bool m_changed {false};
+    std::string m_installStatus; // Mission installation progress, reported if not empty
 };
 
 class SapientMessageSensorTask : public SapientMessage
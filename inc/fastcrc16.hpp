@@ -0,0 +1,53 @@
+#ifndef SRC_FASTCRC16_HPP_
+#define SRC_FASTCRC16_HPP_
+
+#include "base/baselib/inc/crc16.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace sapient
+{
+    /// Drop-in replacement for base::Crc16 which processes eight bytes per step using slicing-by-8 tables.
+    /// The CRC parameters are not assumed: the first time the class is used each of the common CRC16 variants
+    /// is checked against base::Crc16 and the one which matches is used. If none match the calculation falls
+    /// back to base::Crc16, so the result is always the same as base::Crc16.
+    class FastCrc16
+    {
+    public:
+        FastCrc16();
+
+        void write(uint8_t b);
+        void write(const uint8_t *data, size_t size);
+        uint16_t read() const;
+        void reset();
+
+    private:
+        typedef std::array<std::array<uint16_t, 256>, 8> Tables;
+
+        struct Variant
+        {
+            const char *name;
+            uint16_t poly; //!< Polynomial, bit-reversed for reflected variants
+            uint16_t init;
+            uint16_t xorOut;
+            bool reflected;
+        };
+
+        static const Variant kVariants[];
+        static const size_t kNumVariants;
+
+        static void calibrate();
+        static void buildTables(Variant const &variant);
+        static uint16_t compute(uint16_t crc, const uint8_t *data, size_t size);
+
+        static bool s_accelerated;
+        static Variant s_variant;
+        static Tables s_tables;
+
+        uint16_t m_crc;
+        mercury::embedded::base::Crc16 m_fallback; //!< Used if no variant conforms
+    };
+}
+#endif //SRC_FASTCRC16_HPP_
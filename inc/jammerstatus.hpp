@@ -0,0 +1,49 @@
+#ifndef SRC_JAMMERSTATUS_HPP_
+#define SRC_JAMMERSTATUS_HPP_
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace sapient
+{
+    /// Jammer status published by the Mercury threads, one per jammer, for the SAPIENT side to report
+    class JammerStatus
+    {
+    public:
+        typedef std::chrono::system_clock::time_point TimePoint;
+
+        static JammerStatus &instance();
+
+        /// Mission installation is in progress on a jammer
+        /// @param port Serial port of the jammer
+        /// @param eta Estimated completion time, only meaningful if etaValid
+        void setInstallProgress(std::string const &port, uint8_t percent, bool etaValid, TimePoint eta);
+        void clearInstallProgress(std::string const &port);
+
+        /// Progress across all jammers: the lowest percentage and the latest completion time
+        /// @return True if mission installation is in progress on any jammer
+        bool getInstallProgress(uint8_t &percent, bool &etaValid, TimePoint &eta);
+
+        /// Incremented whenever the status changes
+        uint32_t revision();
+
+    private:
+        JammerStatus() {}
+        virtual ~JammerStatus() {}
+
+        struct InstallProgress
+        {
+            uint8_t percent {0};
+            bool etaValid {false};
+            TimePoint eta;
+        };
+
+        std::mutex m_mutex;
+        std::map<std::string, InstallProgress> m_installs; //!< Installations in progress by serial port
+        uint32_t m_revision {0};
+    };
+}
+#endif //SRC_JAMMERSTATUS_HPP_
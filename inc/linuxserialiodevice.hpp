@@ -3,6 +3,8 @@
 
 #include "sio/siolib/inc/serialiodevice.hpp"
 
+#include <termios.h>
+
 namespace mercury
 {
     namespace embedded
@@ -26,18 +28,25 @@ namespace mercury
 
                 void reinitialise(int32_t baud = 115200);
 
+                /// @return Baud rate the port was last configured for
+                int32_t baud() const;
+
+                /// @return True if the baud rate is supported, in which case speed is set to the termios speed
+                static bool getSpeed(int32_t baud, speed_t &speed);
+
                 void read();
 
             private:
                 LinuxSerialIoDevice(std::string const &node);
                 bool installSignalHandler();
                 static void signalHandler(int status);
-                static bool setInterfaceAttribs(int fd, int speed, bool parity);
+                static bool setInterfaceAttribs(int fd, speed_t speed, bool parity);
                 friend SerialIoDevice* getSerialIoDevice(std::string const &node);
 
                 std::string m_node;
                 int m_fd;
                 bool m_isGood;
+                int32_t m_baud;
             };
         }
     }
@@ -0,0 +1,67 @@
+#ifndef SRC_MISSIONFRAMES_HPP_
+#define SRC_MISSIONFRAMES_HPP_
+
+#include "comms/commslib/inc/message.hpp"
+#include "missionstore.hpp"
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace sapient
+{
+    /// Upload messages for mission content, built once per content before the upload starts so that the upload only
+    /// has to send them. The target is sensitive to gaps between data messages so nothing which can be done up front
+    /// is left to the upload loop. Messages are shared by all of the jammers and kept for the most recently uploaded
+    /// contents.
+    class MissionFrames
+    {
+    public:
+        struct Frame
+        {
+            mercury::embedded::comms::Message msg;
+            uint32_t bytes {0}; //!< Mission bytes carried by the message
+        };
+
+        struct Frames
+        {
+            MissionStore::ContentId contentId;
+            std::vector<Frame> data; //!< Data messages, in sequence number order starting from zero
+            mercury::embedded::comms::Message crc; //!< VerifyMissionFileCrcCommand which follows the data
+        };
+
+        typedef std::shared_ptr<const Frames> FramesPtr;
+
+        static MissionFrames &instance();
+
+        /// Get the upload messages for a mission, building them if they are not already cached
+        /// @param fileName Mission file, read if the content is not in the shared mission cache
+        bool getFrames(std::string const &fileName, MissionStore::Mission const &mission, FramesPtr &frames);
+
+        static const uint32_t kChunkSize = 253; //!< Mission bytes per data message, the maximum message payload size
+
+    private:
+        MissionFrames() {}
+        virtual ~MissionFrames() {}
+
+        static const uint32_t kMaxCachedContents = 4; //!< Number of contents for which messages are kept
+
+        struct Entry
+        {
+            FramesPtr frames;
+            uint32_t lastUsed {0};
+        };
+
+        static bool build(std::string const &fileName, MissionStore::Mission const &mission, Frames &frames);
+        static bool readContent(std::string const &fileName, MissionStore::Mission const &mission,
+                                std::vector<uint8_t> &buffer);
+
+        std::mutex m_mutex;
+        std::map<MissionStore::ContentId, Entry> m_entries;
+        uint32_t m_useCount {0};
+    };
+}
+#endif //SRC_MISSIONFRAMES_HPP_
@@ -0,0 +1,121 @@
+#ifndef SRC_MISSIONSTORE_HPP_
+#define SRC_MISSIONSTORE_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+
+namespace sapient
+{
+    /// Cache of validated mission files, indexed by file name and by content. Entries are validated (size, CRC)
+    /// once and then kept up to date by watching the mission directory with inotify, so uploads do not need to
+    /// re-read the file to get its CRC.
+    /// Validated entries are persisted in an index file in the mission directory and trusted on the next start
+    /// for as long as the file size and modification time still match.
+    class MissionStore
+    {
+    public:
+        /// Identity of mission content, missions with equal content IDs are byte-identical
+        struct ContentId
+        {
+            uint64_t hash {0};
+            int32_t size {0};
+            uint16_t crc {0};
+
+            bool operator==(ContentId const &rhs) const { return (hash == rhs.hash) && (size == rhs.size) && (crc == rhs.crc); }
+            bool operator!=(ContentId const &rhs) const { return !(*this == rhs); }
+            bool operator<(ContentId const &rhs) const
+            {
+                return (hash != rhs.hash) ? (hash < rhs.hash) : ((size != rhs.size) ? (size < rhs.size) : (crc < rhs.crc));
+            }
+        };
+
+        struct Mission
+        {
+            std::string fileName;
+            int32_t size {0};
+            uint16_t crc {0};
+            int64_t mtime {0}; //!< Modification time, in nanoseconds
+            uint64_t hash {0}; //!< FNV-1a hash of the file content
+
+            ContentId contentId() const
+            {
+                ContentId id;
+                id.hash = hash;
+                id.size = size;
+                id.crc = crc;
+                return id;
+            }
+        };
+
+        typedef std::shared_ptr<const Mission> MissionPtr;
+
+        static MissionStore &instance();
+
+        /// Scan the mission directory, only validating files which are not in the index or have changed
+        /// @param directory Mission directory, including trailing separator e.g. missions/
+        void load(std::string const &directory);
+
+        /// Watch the mission directory and swap in re-validated entries when files change, never returns
+        /// @param directory Mission directory, including trailing separator e.g. missions/
+        /// @param changed Called after entries have been swapped or removed
+        void watch(std::string directory, std::function<void()> changed = nullptr);
+
+        /// Get mission entry, validating the file if it is not already in the store
+        bool getMission(std::string const &fileName, MissionPtr &mission);
+
+        /// Check whether there is an entry for the file without attempting to validate it
+        bool hasMission(std::string const &fileName);
+
+        /// Get a snapshot of all of the mission entries
+        void getMissions(std::vector<MissionPtr> &missions);
+
+        /// Get the content ID of a mission file without attempting to validate it
+        bool getContentId(std::string const &fileName, ContentId &id);
+
+        /// Get any mission entry which has the given content
+        bool getContent(ContentId const &id, MissionPtr &mission);
+
+        /// Re-validate the file and swap in the new entry (entry is removed if the file is no longer valid)
+        bool refresh(std::string const &fileName, MissionPtr &mission);
+
+        /// Check whether the mission entry describes the file with the given status
+        static bool isCurrent(Mission const &mission, struct stat const &st);
+
+        /// Hash used to identify mission content, may be called repeatedly to hash content in parts
+        static uint64_t contentHash(const uint8_t *data, size_t size, uint64_t hash = kHashSeed);
+
+        static const uint64_t kHashSeed = 0xcbf29ce484222325ull;
+
+    private:
+        MissionStore() {}
+        virtual ~MissionStore() {}
+
+        const std::string kIndexFileName {".index"};
+        static const uint32_t kWatchRetryTime_s = 2; //!< Time, in seconds, to wait before re-attempting to watch the mission directory
+        static const size_t kEventBufferSize = 4096; //!< Size of buffer used to read inotify events
+        static const uint32_t kMaxValidationThreads = 8; //!< Maximum number of threads used to validate missions
+
+        void update(std::string const &fileName);
+        void remove(std::string const &fileName);
+        void rebuildContents();
+        void readIndex(std::string const &directory, std::map<std::string, MissionPtr> &missions) const;
+        void writeIndex(std::string const &directory);
+        static std::vector<uint8_t> validateAll(std::vector<std::shared_ptr<Mission>> const &missions);
+        static bool validate(std::string const &fileName, Mission &mission);
+        static int64_t modificationTime(struct stat const &st);
+
+        std::mutex m_mutex;
+        std::map<std::string, MissionPtr> m_missions; //!< Missions by file name
+        std::map<ContentId, MissionPtr> m_contents; //!< One mission for each distinct content
+        std::atomic<uint32_t> m_revision {0}; //!< Incremented every time an entry is swapped or removed
+        std::atomic<bool> m_indexDirty {false};
+    };
+}
+#endif //SRC_MISSIONSTORE_HPP_
@@ -0,0 +1,52 @@
+#ifndef SRC_MODEARBITER_HPP_
+#define SRC_MODEARBITER_HPP_
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+
+namespace sapient
+{
+    /// Arbitrates between the composite modes requested by several task sources. The effective mode is the mode
+    /// requested by the highest priority source, requests from sources of equal priority are combined. Requests
+    /// may expire after a fixed time. The number of sources is fixed so updates take constant time.
+    class ModeArbiter
+    {
+    public:
+        typedef std::chrono::steady_clock::time_point TimePoint;
+
+        static const uint32_t kMaxSources = 8;
+
+        /// @param mode Requested mode, 0 to withdraw the source's request
+        /// @param expiry_ms Time, in milliseconds, before the request expires, 0 if the request does not expire
+        /// @return True if the effective mode has changed
+        bool request(uint32_t source, uint32_t mode, int32_t priority, uint32_t expiry_ms, TimePoint now);
+
+        /// Drop requests which have expired
+        /// @return True if the effective mode has changed
+        bool expire(TimePoint now);
+
+        /// @return True if there is a request which expires, in which case time is set to the earliest expiry
+        bool nextExpiry(TimePoint &time) const;
+
+        uint32_t effectiveMode() const;
+
+    private:
+        struct Request
+        {
+            bool active {false};
+            uint32_t mode {0};
+            int32_t priority {0};
+            bool expires {false};
+            TimePoint expiry;
+        };
+
+        bool update();
+
+        std::array<Request, kMaxSources> m_requests;
+        uint32_t m_effectiveMode {0};
+        bool m_expires {false};
+        TimePoint m_nextExpiry;
+    };
+}
+#endif //SRC_MODEARBITER_HPP_
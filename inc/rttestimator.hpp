@@ -0,0 +1,38 @@
+#ifndef SRC_RTTESTIMATOR_HPP_
+#define SRC_RTTESTIMATOR_HPP_
+
+#include <cstdint>
+
+namespace sapient
+{
+    /// Reply timeout for one class of command, set from the measured round-trip time as for the TCP retransmission
+    /// timeout (RFC 6298): smoothed round-trip time plus four times its variation, kept between a floor and a
+    /// ceiling. Until there is a sample the ceiling is used. Each timeout doubles the timeout until the next sample.
+    class RttEstimator
+    {
+    public:
+        RttEstimator(uint32_t floor_ms, uint32_t ceiling_ms);
+
+        uint32_t timeout_ms() const;
+
+        /// Add a round-trip time, only for replies which cannot be to an earlier attempt (Karn's algorithm)
+        void sample(uint32_t rtt_ms);
+
+        /// No reply within the timeout
+        void timedOut();
+
+        /// Forget all samples
+        void reset();
+
+    private:
+        static const uint32_t kMaxBackoff = 6; //!< Limits the number of times the timeout is doubled
+
+        uint32_t m_floor_ms;
+        uint32_t m_ceiling_ms;
+        bool m_hasSample {false};
+        float m_srtt_ms {0.0f}; //!< Smoothed round-trip time
+        float m_rttvar_ms {0.0f}; //!< Round-trip time variation
+        uint32_t m_backoff {0}; //!< Number of timeouts since the last sample
+    };
+}
+#endif //SRC_RTTESTIMATOR_HPP_
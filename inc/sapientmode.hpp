@@ -8,36 +8,149 @@
 #ifndef SRC_SAPIENTMODE_HPP_
 #define SRC_SAPIENTMODE_HPP_
 
+#include "missionstore.hpp"
+#include "modearbiter.hpp"
+
 #include <cstdint>
 #include <string>
+#include <array>
 #include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 namespace sapient
 {
+    /// Decides how long the mode accumulation window stays open after the last task
+    class ModeAccumulationPolicy
+    {
+    public:
+        virtual ~ModeAccumulationPolicy() {}
+
+        /// @param mode Composite mode accumulated so far
+        /// @param taskSetComplete True if the SDA has signalled that the task set is complete
+        /// @return Time, in milliseconds, to wait for further tasks, 0 to latch the mode immediately
+        virtual uint32_t windowTime_ms(uint32_t mode, bool taskSetComplete) const = 0;
+    };
+
+    /// Latches immediately on a complete task set, otherwise waits for a fixed debounce time. A stop has its own, much
+    /// shorter, debounce time: a retask arrives as a stop followed straight away by the new modes, so the stop is held
+    /// just long enough for the new modes to replace it.
+    class DebounceAccumulationPolicy : public ModeAccumulationPolicy
+    {
+    public:
+        DebounceAccumulationPolicy(uint32_t debounce_ms, uint32_t stopDebounce_ms) :
+            m_debounce_ms(debounce_ms),
+            m_stopDebounce_ms(stopDebounce_ms)
+        {
+        }
+
+        uint32_t windowTime_ms(uint32_t mode, bool taskSetComplete) const
+        {
+            return taskSetComplete ? 0 : ((mode == 0) ? m_stopDebounce_ms : m_debounce_ms);
+        }
+
+    private:
+        uint32_t m_debounce_ms;
+        uint32_t m_stopDebounce_ms;
+    };
+
+    /// Accumulates task modes from each task source into a composite mode bitmask, arbitrates between sources to
+    /// give the effective mode and maps the effective mode to a mission.
+    ///
+    /// The task mode to bit and bitmask to mission mappings are loaded from a mode map file and compiled into
+    /// flat lookup tables. Each line of the file is one of:
+    ///     mode <task-mode> <bit>           e.g. mode 1 0
+    ///     mission <bitmask> <mission-name> e.g. mission 0x81 KT-956-0185-00_AB_AAA_AC_AA_AA
+    ///     debounce <time-ms>               e.g. debounce 1000
+    ///     stopdebounce <time-ms>           e.g. stopdebounce 50
+    /// Lines starting with # are comments. Bitmasks which are not listed use the built-in ECM decoding of the seven
+    /// "wideband, omni" modes. If there are no mode lines then task modes 1 to 7 map to bits 0 to 6.
     class SapientMode
     {
     public:
+        static const int32_t kPriorityScheduled = 0; //!< Priority of scheduled tasks
+        static const int32_t kPrioritySda = 10; //!< Priority of tasks from an SDA
+        static const int32_t kPriorityOperator = 20; //!< Priority of local operator overrides
+
         static SapientMode &instance();
 
-        void setMode(int32_t mode);
+        bool loadModeMap(std::string const &fileName);
+        void setPolicy(std::unique_ptr<ModeAccumulationPolicy> policy);
+
+        /// Add a source of tasks, each source accumulates its own composite mode which is then arbitrated
+        /// @param expiry_ms Time, in milliseconds, that a latched mode from this source remains valid, 0 for ever
+        /// @return Source ID to use when setting modes
+        uint32_t addSource(std::string const &name, int32_t priority, uint32_t expiry_ms = 0);
+        void setMode(uint32_t source, int32_t mode);
+        void completeTaskSet(uint32_t source);
+
+        /// @return Effective composite mode
         int32_t mode();
+
+        /// @return Generation of the effective mode, incremented every time the effective mode or the mission
+        ///         library changes
+        uint32_t modeGeneration();
+
+        /// Wake waitForModeChange as if the mode had changed, as the mission for the effective mode may have changed
+        void notifyMissionsChanged();
+
+        /// Wait until the effective mode changes
+        /// @param generation Mode generation last seen by the caller, updated to the current generation
+        /// @return True if the effective mode changed, false on timeout
+        bool waitForModeChange(uint32_t &generation, uint32_t timeout_ms);
+
         bool getMissionName(uint32_t mode, std::string &name) const;
         bool getMissionFileName(uint32_t mode, std::string &name) const;
-        bool getMissionName(std::string &name) const;
+        bool getMissionContentId(uint32_t mode, MissionStore::ContentId &id) const;
+        bool getMissionContentId(std::string const &name, MissionStore::ContentId &id) const;
         bool doMissionFilesExist() const;
+        std::string const &missionFileLocation() const;
 
     private:
-        SapientMode(){}
+        typedef std::chrono::time_point<std::chrono::steady_clock> TimePoint;
+
+        struct Source
+        {
+            std::string name;
+            int32_t priority {0};
+            uint32_t expiry_ms {0};
+            uint32_t mode {0}; //!< Composite mode accumulated in the current window
+            bool windowOpen {false};
+            bool taskSetComplete {false};
+            uint32_t windowTime_ms {0};
+            TimePoint windowOpenTime;
+            TimePoint modeSetTime;
+        };
+
+        SapientMode();
         virtual ~SapientMode() {}
 
+        void update(TimePoint now);
+        void recordLatchDelay(Source const &source, uint32_t delay_ms);
+        void compileModeMap(std::vector<int32_t> const &modeBits, std::vector<std::string> const &missionNames);
+        bool getDefaultMissionName(uint32_t mode, std::string &name) const;
+
         const std::string kMissionPrefix {"KT-956-0185-00"};
         const std::string kMissionSuffix {".iff"};
         const std::string kMissionFileLocation {"missions/"};
-        static const uint32_t kModeAccumulationTime_ms = 1000;
-        std::chrono::time_point<std::chrono::steady_clock> m_modeSetTime;
-        std::atomic<uint32_t> m_mode {0};
-        std::atomic<uint32_t> m_latchedMode {std::numeric_limits<uint32_t>::max()};
+        static const uint32_t kModeAccumulationTime_ms = 1000; //!< Default debounce time
+        static const uint32_t kStopAccumulationTime_ms = 50; //!< Default debounce time for a stop
+        static const size_t kNumLatchDelayBins = 7;
+        static const int32_t kDefaultModeBits = 7; //!< Number of modes decoded by the built-in ECM decoding
+        static const int32_t kMaxModeBits = 12; //!< Limits the size of the bitmask to mission table
+        static const int32_t kMaxTaskMode = 255; //!< Limits the size of the task mode to bit table
+        std::vector<int32_t> m_modeBits; //!< Bit for each task mode, -1 if the task mode is not mapped
+        std::vector<std::string> m_missionNames; //!< Mission for each composite mode, empty if not mapped
+        std::mutex m_mutex; //!< Guards the sources, arbiter and accumulation windows
+        std::condition_variable m_modeChanged; //!< Signalled when the effective mode or a window changes
+        std::unique_ptr<ModeAccumulationPolicy> m_policy;
+        std::vector<Source> m_sources; //!< Indexed by source ID
+        ModeArbiter m_arbiter;
+        uint32_t m_modeGeneration {0}; //!< Incremented every time the effective mode or the mission library changes
+        std::array<uint32_t, kNumLatchDelayBins> m_latchDelayHistogram {{0}};
     };
 }
 #endif //SRC_SAPIENTMODE_HPP
@@ -0,0 +1,80 @@
+#ifndef SRC_SHAREDMISSIONCACHE_HPP_
+#define SRC_SHAREDMISSIONCACHE_HPP_
+
+#include "missionstore.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace sapient
+{
+    /// Read-only snapshot of the mission library in POSIX shared memory, for hosts running one mediator per
+    /// jammer. The first mediator populates the cache, later mediators map it to start with validated entries and
+    /// upload from the shared copy of the content, so memory use does not grow with the number of mediators.
+    /// Content is indexed by content ID, each distinct content is stored once.
+    /// The cache is a start-up snapshot, it is not updated when missions change. Content which no longer matches the
+    /// mission store is simply not found, as lookups are by content ID, and is read from the mission file instead.
+    class SharedMissionCache
+    {
+    public:
+        static SharedMissionCache &instance();
+
+        /// Map an existing cache, waiting for it to be populated if another mediator is populating it
+        /// @param name Shared memory object name e.g. /sapient-missions
+        bool attach(std::string const &name);
+
+        /// Check the attached cache matches the mission store and populate a new cache if it does not
+        bool populate(std::string const &name, std::string const &directory);
+
+        /// Get the mission entries in the cache
+        bool getMissions(std::string const &directory, std::map<std::string, MissionStore::MissionPtr> &missions);
+
+        /// Get the cached content for a mission, the content remains mapped for the life of the process
+        bool getContent(MissionStore::ContentId const &id, const uint8_t *&data);
+
+    private:
+        SharedMissionCache() {}
+        virtual ~SharedMissionCache() {}
+
+        static const uint32_t kMagic = 0x53504d43; //!< "SPMC"
+        static const uint32_t kVersion = 1;
+        static const uint32_t kMaxNameLength = 128;
+        static const uint32_t kReadyWaitTime_ms = 30000; //!< Time, in milliseconds, to wait for another process to populate the cache
+        static const uint32_t kReadyPollTime_ms = 100; //!< Time, in milliseconds, between checks that the cache is populated
+
+        struct Header
+        {
+            uint32_t magic;
+            uint32_t version;
+            std::atomic<uint32_t> ready;
+            uint32_t numEntries;
+            uint64_t size;
+        };
+
+        struct Entry
+        {
+            char name[kMaxNameLength];
+            int32_t size;
+            uint16_t crc;
+            int64_t mtime;
+            uint64_t hash;
+            uint64_t offset; //!< Offset of the content from the start of the cache
+        };
+
+        bool isAttached();
+        void map(const uint8_t *base, uint64_t size);
+        bool isConsistent(std::string const &directory, std::vector<MissionStore::MissionPtr> const &missions);
+        static bool readContent(MissionStore::Mission const &mission, uint8_t *data);
+        static uint64_t align(uint64_t offset);
+
+        std::mutex m_mutex;
+        const uint8_t *m_base {nullptr}; //!< Current mapping, previous mappings are never unmapped as content may still be in use
+        uint64_t m_size {0};
+        std::map<MissionStore::ContentId, uint64_t> m_contents; //!< Offset of each content in the current mapping
+    };
+}
+#endif //SRC_SHAREDMISSIONCACHE_HPP_
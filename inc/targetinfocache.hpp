@@ -0,0 +1,53 @@
+#ifndef SRC_TARGETINFOCACHE_HPP_
+#define SRC_TARGETINFOCACHE_HPP_
+
+#include "base/baselib/inc/version.hpp"
+#include "system/systemlib/inc/mcmstates.hpp"
+
+#include <cstdint>
+#include <string>
+
+namespace sapient
+{
+    /// Cache of information queried from the target, so that repeated queries do not each cost a serial round trip.
+    /// The version cannot change without a reconnect so it is kept for the whole connection; state and mission
+    /// name are kept for a short time and dropped whenever one of our own commands may have changed them.
+    class TargetInfoCache
+    {
+    public:
+        /// Forget everything, called when the target stops responding or the connection to it is (re)established
+        void reset();
+
+        /// Forget state and mission name, called after commands which change them
+        void invalidate();
+
+        bool getVersion(mercury::embedded::base::Version &version);
+        void setVersion(mercury::embedded::base::Version const &version);
+        bool getState(mercury::embedded::system::McmState::State &state);
+        void setState(mercury::embedded::system::McmState::State state);
+        bool getMissionName(std::string &name);
+        void setMissionName(std::string const &name);
+
+        uint32_t hits() const;
+        uint32_t misses() const;
+
+    private:
+        static const uint32_t kStateTtl_ms = 250; //!< Time, in milliseconds, for which target state is reused
+        static const uint32_t kMissionNameTtl_ms = 2000; //!< Time, in milliseconds, for which the mission name is reused
+
+        bool count(bool hit);
+        static bool isFresh(bool valid, uint32_t time, uint32_t ttl_ms);
+
+        mercury::embedded::base::Version m_version;
+        bool m_versionValid {false};
+        mercury::embedded::system::McmState::State m_state {mercury::embedded::system::McmState::Unknown};
+        bool m_stateValid {false};
+        uint32_t m_stateTime {0};
+        std::string m_missionName;
+        bool m_missionNameValid {false};
+        uint32_t m_missionNameTime {0};
+        uint32_t m_hits {0}; //!< Queries answered from the cache, each one a round trip saved
+        uint32_t m_misses {0};
+    };
+}
+#endif //SRC_TARGETINFOCACHE_HPP_
@@ -0,0 +1,58 @@
+#ifndef SRC_UPLOADPACER_HPP_
+#define SRC_UPLOADPACER_HPP_
+
+#include "base/baselib/inc/version.hpp"
+
+#include <cstdint>
+#include <map>
+
+namespace sapient
+{
+    /// AIMD pacing for mission data messages. Uploads start at the fastest rate (full window, no inter-packet
+    /// delay) and the rate is halved whenever the target rejects or fails to acknowledge a data message, then
+    /// increased a step at a time whilst messages are acknowledged. Halving shrinks the window first and then
+    /// doubles the inter-packet delay; increasing removes delay first and then grows the window.
+    /// The rate in use at the end of a successful upload is remembered for the target firmware version, so
+    /// later uploads to the same firmware start from a rate known to work.
+    class UploadPacer
+    {
+    public:
+        /// Start pacing an upload
+        /// @param maxWindow Largest number of unacknowledged data messages the target supports
+        void begin(mercury::embedded::base::Version const &version, uint32_t maxWindow);
+
+        /// Data message acknowledged
+        void acknowledged();
+
+        /// Data message rejected or not acknowledged in time
+        void failed();
+
+        /// Upload finished, a successful upload records the current rate as stable for the target version
+        void completed(bool success);
+
+        /// Number of unacknowledged data messages allowed
+        uint32_t window() const;
+
+        /// Time, in milliseconds, to wait before sending each data message
+        uint32_t delay_ms() const;
+
+    private:
+        static const uint32_t kMaxDelay_ms = 60; //!< Longest inter-packet delay, in milliseconds
+        static const uint32_t kIncreaseInterval = 16; //!< Consecutive acknowledgements needed before the rate is increased
+
+        struct Rate
+        {
+            uint32_t window;
+            uint32_t delay_ms;
+        };
+
+        static uint64_t key(mercury::embedded::base::Version const &version);
+
+        std::map<uint64_t, Rate> m_stable; //!< Last known good rate for each target version
+        uint64_t m_key {0};
+        uint32_t m_maxWindow {1};
+        Rate m_rate {1, 0};
+        uint32_t m_acknowledged {0}; //!< Consecutive acknowledgements since the rate last changed
+    };
+}
+#endif //SRC_UPLOADPACER_HPP_
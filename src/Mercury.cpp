@@ -8,6 +8,8 @@
 #include "mercury.hpp"
 #include "sapient.hpp"
 #include "sapientmode.hpp"
+#include "jammerstatus.hpp"
+#include "missionframes.hpp"
 #include "debuglog.hpp"
 #include "board.hpp"
 
@@ -21,8 +23,12 @@
 #include "system/systemlib/inc/moduleids.hpp"
 
 #include <syslog.h>
+#include <algorithm>
 #include <cstdio>
 #include <cstdarg>
+#include <cinttypes>
+#include <deque>
+#include <sys/stat.h>
 
 namespace sapient
 {
@@ -30,6 +36,15 @@ namespace sapient
     {
     }
 
+    Mercury::Mercury(Config const &config) :
+        m_config(config)
+    {
+        if (m_config.baudRates.empty())
+        {
+            m_config.baudRates.push_back(int32_t(kBaudDefault));
+        }
+    }
+
     Mercury::~Mercury()
     {
     }
@@ -37,83 +52,229 @@ namespace sapient
     void Mercury::operator()(std::string port)
     {
         bool ok(true);
-        sio::SerialIoDevice *sio = sio::getSerialIoDevice(port);
+        m_port = port;
+        m_pSerialIoDevice = sio::getSerialIoDevice(port);
+        sio::SerialIoDevice *sio = m_pSerialIoDevice;
+        if (baud() != kBaudDefault)
+        {
+            sio->reinitialise(baud());
+        }
+
+        // Pick up the mission last installed through this port so a restart does not force a reinstall
+        m_installedFileName = SapientMode::instance().missionFileLocation() + kInstalledFilePrefix +
+                              port.substr(port.find_last_of('/') + 1);
+        readInstalledMission();
 
         while (ok)
         {
+            bool nextBaud(false);
             if (sio->isGood())
             {
                 comms::CommsDevice comms(*sio, kMessageTimeout_ms);
                 m_pCommsDevice = &comms;
+                m_responseSeen = false;
+                m_rttQuery.reset();
+                m_rttData.reset();
+                m_rttUpload.reset();
+                m_rttControl.reset();
+                m_rttCrc.reset();
+
+                if (m_upload.interrupted)
+                {
+                    // UploadMissionCommand always starts a new transfer and there is no command to continue one, so the
+                    // mission is sent again from the start when the control loop finds it is not installed
+                    log(LOG_WARNING, "upload of %s interrupted at %d of %d bytes cannot be resumed, target protocol has "
+                        "no resume command", m_upload.fileName.c_str(), m_upload.bytesAcked, m_upload.contentId.size);
+                    m_upload.interrupted = false;
+                }
 
-                // Run loop which controls Mercury
-                while(sio->isGood())
+                // Run the control state machine. It acts on every effective mode change, and every change to the mission
+                // library, straight away and otherwise only checks the target's health once per period, so that
+                // commands are not queued behind status polls.
+                setNoResponse();
+                bool modeChanged(true);
+                uint32_t noResponse(0);
+                while(sio->isGood() && !nextBaud)
                 {
-                    if (ping())
+                    uint32_t mode(sapient::SapientMode::instance().mode());
+                    bool retry((m_state == state::NoResponse) || (m_state == state::NotReadyForMission));
+                    if (modeChanged || retry)
                     {
-                        // Check the Sapient mode
-                        uint32_t mode(sapient::SapientMode::instance().mode());
-
-                        // Does the Sapient side want us to be jamming?
-                        if (mode > 0)
-                        {
-                            // Is the right mission file already loaded?
-                            bool reloadMission(true);
-                            system::McmState::State state(getTargetState());
-                            if (!system::McmState::isZeroized(state))
-                            {
-                                std::string sapientMission, mercuryMission;
-                                sapient::SapientMode::instance().getMissionName(mode, sapientMission);
-                                if (getMissionName(mercuryMission))
-                                {
-                                    reloadMission = (sapientMission != mercuryMission);
-                                }
-                                else
-                                {
-                                    log(LOG_WARNING, "failed to retrieve mission name from jammer");
-                                }
-                            }
-                            if (reloadMission)
-                            {
-                                stopJamming();
-                                waitReadyForMission();
-                                std::string file;
-                                sapient::SapientMode::instance().getMissionFileName(mode, file);
-                                log(LOG_INFO, "sending %s", file.c_str());
-                                sendMission(file);
-                            }
-
-                            // Start jamming
-                            if (!system::McmState::isJammingOrRequested(state))
-                            {
-                                startJamming();
-                            }
-                        }
-                        else
-                        {
-                            system::McmState::State state(getTargetState());
-                            if (system::McmState::isJamming(state))
-                            {
-                                stopJamming();
-                            }
-                        }
+                        reconcile(mode);
                     }
                     else
                     {
-                        log(LOG_WARNING, "jammer ping failed");
+                        checkHealth(mode);
                     }
+
+                    // Sleep until the effective mode changes or it is time to check the target again, retry sooner
+                    // if the target is not responding or the mission could not be loaded
+                    retry = (m_state == state::NoResponse) || (m_state == state::NotReadyForMission);
+                    uint32_t wait_ms(retry ? kTimeBetweenPings_ms : m_config.healthCheckPeriod_ms);
+                    modeChanged = sapient::SapientMode::instance().waitForModeChange(m_modeGeneration, wait_ms);
+
+                    // The target may be set to a different rate, try the next one if it keeps failing to respond
+                    noResponse = (m_state == state::NoResponse) ? (noResponse + 1) : 0;
+                    nextBaud = (noResponse >= kBaudProbeAttempts) && (m_config.baudRates.size() > 1);
                 }
                 m_state = state::SerialDisconnected;
                 m_pCommsDevice = nullptr;
+                logTargetInfoCache();
             }
 
-            // Wait before attempting to reconnect to serial port
-            ::sleep(2);
-            sio->reinitialise();
+            if (nextBaud)
+            {
+                m_baudIndex = (m_baudIndex + 1) % m_config.baudRates.size();
+                log(LOG_WARNING, "no response from target, trying %d baud", baud());
+            }
+            else
+            {
+                // Wait before attempting to reconnect to serial port
+                ::sleep(2);
+            }
+            sio->reinitialise(baud());
+        }
+    }
+
+    void Mercury::reconcile(uint32_t mode)
+    {
+        if (!queryTarget(mode > 0))
+        {
+            setNoResponse();
+            log(LOG_WARNING, "jammer ping failed");
+        }
+        // Does the Sapient side want us to be jamming?
+        else if (mode > 0)
+        {
+            // Is the right mission content already loaded?
+            bool reloadMission(true);
+            system::McmState::State state(getTargetState());
+            if (!system::McmState::isZeroized(state))
+            {
+                std::string mercuryMission;
+                if (getMissionName(mercuryMission))
+                {
+                    reloadMission = !isMissionInstalled(mode, mercuryMission);
+                }
+                else
+                {
+                    log(LOG_WARNING, "failed to retrieve mission name from jammer");
+                }
+            }
+
+            // Keep the current mission rather than stopping if there is nothing to replace it with, but do not start
+            // jamming with a mission which was not chosen for this mode
+            std::string file;
+            bool unmapped(false);
+            if (reloadMission && !sapient::SapientMode::instance().getMissionFileName(mode, file))
+            {
+                log(LOG_WARNING, "no mission for mode %u in the mode map, keeping the current mission", mode);
+                reloadMission = false;
+                unmapped = true;
+            }
+
+            // Work towards this mode is abandoned if a newer mode needs something else
+            CancellationToken token(makeCancellationToken(mode));
+            bool reloaded(!reloadMission);
+            if (reloadMission)
+            {
+                stopJamming();
+                waitReadyForMission(token);
+                if (!isCancelled(token))
+                {
+                    log(LOG_INFO, "sending %s", file.c_str());
+                    reloaded = sendMission(file, token);
+                }
+                state = system::McmState::Unknown;
+            }
+
+            // Start jamming, unless the mode has moved on in which case the next pass acts on it
+            if (isCancelled(token))
+            {
+                log(LOG_INFO, "mode changed whilst reconciling mode %u", mode);
+            }
+            else if (!reloaded)
+            {
+                // Not jamming with the wrong mission, the control loop tries again shortly
+                m_state = state::NotReadyForMission;
+                log(LOG_WARNING, "mission reload failed, will retry");
+            }
+            else if (unmapped)
+            {
+                m_state = system::McmState::isJammingOrRequested(state) ? state::Jamming : state::Idle;
+            }
+            else
+            {
+                bool jamming(system::McmState::isJammingOrRequested(state) || startJamming());
+                m_state = jamming ? state::Jamming : state::Idle;
+            }
+        }
+        else
+        {
+            system::McmState::State state(getTargetState());
+            if (system::McmState::isJamming(state))
+            {
+                stopJamming();
+            }
+            m_state = state::Idle;
+        }
+    }
+
+    void Mercury::checkHealth(uint32_t mode)
+    {
+        // A single status request both confirms the target is alive and that it is doing what was last asked
+        system::McmState::State state(getTargetState());
+        if (state == system::McmState::Unknown)
+        {
+            setNoResponse();
+            log(LOG_WARNING, "jammer health check failed");
+        }
+        else if (system::McmState::isZeroized(state) ||
+                 ((m_state == state::Jamming) != system::McmState::isJammingOrRequested(state)) ||
+                 ((m_state == state::Jamming) != (mode > 0)))
+        {
+            log(LOG_INFO, "target state %u differs from expected, reconciling", state);
+            reconcile(mode);
+        }
+    }
+
+    bool Mercury::queryTarget(bool missionName)
+    {
+        // State and mission name are independent so are queried in one round trip, replies are cached for the getters
+        // to pick up. Any reply shows the target is alive so a ping is only added if there is nothing else to send.
+        std::vector<Transaction> transactions;
+        system::McmState::State state;
+        std::string name;
+        if (!m_targetInfo.getState(state))
+        {
+            transactions.push_back(makeTransaction(system::Command::GetState));
+        }
+        if (missionName && !m_targetInfo.getMissionName(name))
+        {
+            transactions.push_back(makeTransaction(system::Command::GetMissionName));
+        }
+        if (transactions.empty() && !isRecentlyAlive())
+        {
+            transactions.push_back(makeTransaction(system::Command::Ping));
+        }
+
+        (void)transact(transactions, m_rttQuery);
+        for (auto const &transaction : transactions)
+        {
+            if (transaction.complete && (transaction.commandId == system::Command::GetState))
+            {
+                (void)parseTargetState(transaction.resp);
+            }
+            else if (transaction.complete && (transaction.commandId == system::Command::GetMissionName))
+            {
+                (void)parseMissionName(transaction.resp, name);
+            }
         }
+
+        return isRecentlyAlive();
     }
 
-    bool Mercury::waitReadyForMission()
+    bool Mercury::waitReadyForMission(CancellationToken &token)
     {
         bool ready(false);
         uint32_t start(board::systemTimeMs());
@@ -122,8 +283,8 @@ namespace sapient
         bool keepWaiting(true);
         while (!ready && keepWaiting)
         {
-            keepWaiting = ((board::systemTimeMs() - start) <= kWaitReadyTime_ms);
-            if (keepWaiting && m_pCommsDevice->getIoDevice().isGood())
+            keepWaiting = ((board::systemTimeMs() - start) <= kWaitReadyTime_ms) && isLinkUp() && !isCancelled(token);
+            if (keepWaiting)
             {
                 // Ping
                 if (ping())
@@ -150,7 +311,7 @@ namespace sapient
                         }
                         else if (state == system::McmState::Unknown)
                         {
-                            m_state = Mercury::state::NoResponse;
+                            setNoResponse();
                             log(LOG_WARNING, "get target state failed");
                         }
                         else if (system::McmState::isStartup(state))
@@ -166,20 +327,35 @@ namespace sapient
                     }
                     else
                     {
-                        m_state = Mercury::state::NoResponse;
+                        setNoResponse();
                         log(LOG_WARNING, "target version fail");
                     }
                 }
                 else
                 {
-                    m_state = Mercury::state::NoResponse;
+                    setNoResponse();
                     log(LOG_WARNING, "ping fail");
-                    usleep(kTimeBetweenPings_ms * 1000);
+                }
+
+                // Replies and target state are cached so asking again straight away would only spin, wake early if
+                // the mode changes so a cancellation is acted on straight away
+                if (!ready)
+                {
+                    uint32_t generation(token.generation);
+                    (void)sapient::SapientMode::instance().waitForModeChange(generation, kTimeBetweenPings_ms);
                 }
             }
         }
 
-        if (!ready && !keepWaiting)
+        if (!ready && !isLinkUp())
+        {
+            log(LOG_WARNING, "serial link lost waiting for system ready for new mission");
+        }
+        else if (!ready && token.cancelled)
+        {
+            log(LOG_INFO, "cancelled waiting for system ready for new mission");
+        }
+        else if (!ready && !keepWaiting)
         {
             log(LOG_WARNING, "timed out waiting for system ready for new mission");
         }
@@ -187,146 +363,362 @@ namespace sapient
         return ready;
     }
 
-    bool Mercury::sendMission(std::string const& filename)
+    bool Mercury::sendMission(std::string const& filename, CancellationToken &token)
     {
         bool ok(false);
-        int32_t size(0);
-        uint16_t crc(0);
-        FILE *file(::fopen(filename.c_str(), "rb"));
+        MissionStore::MissionPtr mission;
+        MissionFrames::FramesPtr frames;
+        struct stat st;
 
-        getFileSizeAndCrc(file, size, crc);
+        if (MissionStore::instance().getMission(filename, mission) && (::stat(filename.c_str(), &st) == 0) &&
+            !MissionStore::isCurrent(*mission, st))
+        {
+            // File has been replaced since it was validated and the change has not been picked up yet
+            (void)MissionStore::instance().refresh(filename, mission);
+        }
 
-        if (size > 0)
+        // Messages are built before the upload starts so the upload loop only has to send them
+        if (mission && MissionFrames::instance().getFrames(filename, *mission, frames))
         {
-            if (waitReadyForMission())
+            int32_t size(mission->size);
+            uint16_t crc(mission->crc);
+
+            if (waitReadyForMission(token))
             {
                 log(LOG_INFO, "upload %u byte mission, crc 0x%04x", size, crc);
                 system::UploadMissionCommand cmd(static_cast<uint32_t>(size));
-                ok = sendCommandCheckOk(cmd);
+                ok = sendCommandCheckOk(cmd, m_rttUpload);
+                m_targetInfo.invalidate();
                 if (!ok)
                 {
                     log(LOG_WARNING, "upload mission command failed");
                 }
             }
 
-            uint16_t seq(0);
+            // Keep several data messages in flight if enabled, otherwise wait for each to be acknowledged before
+            // sending the next. The pacer sets how many and how quickly.
+            const bool paced(ok);
+            const bool windowed(paced && m_config.windowedUpload);
+            if (paced)
+            {
+                m_pacer.begin(m_targetVersion, windowed ? kUploadWindowSize : 1);
+                m_upload.fileName = filename;
+                m_upload.contentId = mission->contentId();
+                m_upload.nextSeq = 0;
+                m_upload.bytesAcked = 0;
+                m_upload.interrupted = false;
+            }
+
+            // Unacknowledged data messages, oldest first
+            std::deque<DataMessage> inFlight;
+            bool endOfData(frames->data.empty());
+            size_t next(0);
             int32_t totalSent(0);
-            while (ok)
+            uint32_t retries(0);
+            uint32_t timeouts(0);
+            uint32_t uploadStart(board::systemTimeMs());
+            while (ok && !(endOfData && inFlight.empty()))
             {
-                uint8_t buffer[kReadChunkSize];
-                int32_t numBytes(0);
+                // Stop at a message boundary if the mode has moved on
+                if (isCancelled(token))
+                {
+                    log(LOG_INFO, "upload cancelled, %d of %d bytes acknowledged", totalSent, size);
+                    ok = false;
+                }
 
-                numBytes = ::fread(buffer, 1, sizeof(buffer), file);
-                if (numBytes > 0)
+                // Fill the window
+                while (ok && !endOfData && (inFlight.size() < m_pacer.window()))
                 {
-                    uint8_t *pBuffer(buffer);
-                    while (ok && (numBytes > 0))
+                    // Only flush stale messages when nothing is in flight, otherwise acks would be discarded
+                    if (inFlight.empty())
                     {
-                        comms::Message msg;
-                        uint32_t sent (control::DataSender::makeDataMessage(msg, seq++, pBuffer, numBytes, system::Module::MCM));
-                        numBytes -= sent;
-                        pBuffer += sent;
-                        // Add inter-packet delay to mimic PC comms as Mercury can fail upload if we send packets back-to-back
-                        //::usleep(kInterPacketDelay_ms * 1000);
-                        ok = sendMessageCheckOk(msg);
+                        flushMessages();
+                    }
 
+                    DataMessage data;
+                    data.seq = static_cast<uint16_t>(next);
+                    data.frame = &frames->data[next++];
+                    data.retries = 0;
+                    data.resent = false;
+                    endOfData = (next >= frames->data.size());
+                    // Mercury can fail upload if packets are sent back-to-back faster than it can handle them
+                    if (m_pacer.delay_ms() > 0)
+                    {
+                        ::usleep(m_pacer.delay_ms() * 1000);
+                    }
+                    data.sent_ms = board::systemTimeMs();
+                    ok = m_pCommsDevice && m_pCommsDevice->sendMessage(data.frame->msg);
+                    if (ok)
+                    {
+                        inFlight.push_back(data);
+                    }
+                    else
+                    {
+                        log(LOG_ERR, "data send failed");
+                    }
+                }
+
+                // Wait for the oldest data message to be acknowledged, the target acknowledges data messages in the
+                // order it receives them
+                if (ok && !inFlight.empty())
+                {
+                    // Messages which are not replies from the MCM are skipped, only the deadline passing counts as a
+                    // timeout
+                    comms::Message resp;
+                    bool received(false);
+                    uint32_t waitStart(board::systemTimeMs());
+                    uint32_t timeout_ms(m_rttData.timeout_ms());
+                    uint32_t elapsed_ms(0);
+                    while (!received && (elapsed_ms < timeout_ms) && isLinkUp())
+                    {
+                        received = receiveResponse(resp, timeout_ms - elapsed_ms);
+                        elapsed_ms = board::systemTimeMs() - waitStart;
+                    }
+                    if (received && !inFlight.front().resent)
+                    {
+                        // The ack to a retransmitted message may be for either attempt so is not timed
+                        m_rttData.sample(board::systemTimeMs() - inFlight.front().sent_ms);
+                    }
+                    else if (!received)
+                    {
+                        m_rttData.timedOut();
+                    }
+
+                    if (received && isOkResponse(resp))
+                    {
+                        m_pacer.acknowledged();
+                        totalSent += inFlight.front().frame->bytes;
+                        log(LOG_INFO, "sent %u bytes (total %d of %d)", inFlight.front().frame->bytes, totalSent, size);
+                        m_upload.nextSeq = inFlight.front().seq + 1;
+                        m_upload.bytesAcked = totalSent;
+                        inFlight.pop_front();
+                    }
+                    else
+                    {
+                        DataMessage &oldest(inFlight.front());
+                        m_pacer.failed();
+                        if (!received)
+                        {
+                            timeouts++;
+                            m_dataTimeouts++;
+                        }
+
+                        // Retransmitting is pointless once the serial device has gone
+                        ok = isLinkUp() && (oldest.retries < kMaxDataRetries);
                         if (ok)
                         {
-                            totalSent += sent;
-                            log(LOG_INFO, "sent %u bytes (total %d of %d)", sent, totalSent, size);
+                            oldest.retries++;
+                            retries++;
+                            m_dataRetries++;
+                            log(LOG_WARNING, "data message %u %s, retransmitting (retry %u)", oldest.seq,
+                                received ? "rejected" : "timed out", oldest.retries);
+
+                            // Resend the message with the same sequence number. In windowed mode everything after it
+                            // is resent too, on the assumption that the target drops messages which follow a missing
+                            // one (see Config::windowedUpload).
+                            ::usleep(kInterPacketDelay_ms * 1000);
+                            flushMessages();
+                            size_t resend(windowed ? inFlight.size() : 1);
+                            for (auto it = inFlight.begin(); ok && (it != inFlight.begin() + resend); ++it)
+                            {
+                                it->resent = true;
+                                ok = m_pCommsDevice && m_pCommsDevice->sendMessage(it->frame->msg);
+                            }
                         }
-                        else
+
+                        if (!ok)
                         {
                             log(LOG_ERR, "data send failed");
                         }
                     }
                 }
-                else
-                {
-                    break;
-                }
+            }
+
+            if (paced && !ok && !isLinkUp())
+            {
+                m_upload.interrupted = true;
+                log(LOG_ERR, "serial link lost during upload, %d of %d bytes acknowledged (next sequence %u)",
+                    m_upload.bytesAcked, size, m_upload.nextSeq);
+            }
+
+            if (ok)
+            {
+                uint32_t duration_ms(std::max(board::systemTimeMs() - uploadStart, 1u));
+                log(LOG_INFO, "sent %d bytes in %u ms (%u bytes/s) at %d baud", totalSent, duration_ms,
+                    static_cast<uint32_t>(static_cast<uint64_t>(totalSent) * 1000 / duration_ms),
+                    static_cast<sio::LinuxSerialIoDevice*>(m_pSerialIoDevice)->baud());
+            }
+
+            if (retries > 0)
+            {
+                log(LOG_INFO, "%u data retries (%u timeouts) this upload, %u (%u timeouts) in total",
+                    retries, timeouts, m_dataRetries, m_dataTimeouts);
             }
 
             // Do not do anything between the last data packet and the VerifyMissionFileCrcCommand as
             // a short delay here causes the Mercury system to go into the "Mission Upload Failed" state
             if (ok)
             {
-                system::VerifyMissionFileCrcCommand cmd(crc);
+                comms::Message resp;
                 // Add inter-packet delay to mimic FillGun UI comms as Mercury can fail upload if we send packets back-to-back
                 ::usleep(kInterPacketDelay_ms * 1000);
-                // Increase the reply timeout for the VerifyMissionFileCrcCommand
-                m_replyTimeout_ms = kReplyTimeoutCrc_ms;
-                ok = sendCommandCheckOk(cmd);
-                m_replyTimeout_ms = kReplyTimeoutDefault_ms;
+                // VerifyMissionFileCrcCommand replies take much longer than others so have their own timeout
+                ok = sendMessageGetResponse(frames->crc, resp, m_rttCrc) && isOkResponse(resp);
+                m_pacer.completed(ok);
 
                 if (ok)
                 {
-                    ok = waitMissionInstall();
+                    ok = waitMissionInstall(token);
+                    m_targetInfo.invalidate();
                 }
                 else
                 {
                     log(LOG_WARNING, "CRC check failed");
                 }
+
+                if (ok)
+                {
+                    // Record the name the target reports for this content so it can be recognised later
+                    m_loadedMission = mission;
+                    if (getMissionName(m_loadedMissionName))
+                    {
+                        writeInstalledMission();
+                    }
+                    else
+                    {
+                        m_loadedMissionName.clear();
+                    }
+                }
             }
             else
             {
                 log(LOG_WARNING, "data transfer failed");
+                if (paced && !token.cancelled)
+                {
+                    m_pacer.completed(false);
+                }
             }
         }
 
-        ::fclose(file);
+        logTargetInfoCache();
 
         return ok;
     }
 
     bool Mercury::getMissionName(std::string &name)
     {
-        bool result(false);
+        bool result(m_targetInfo.getMissionName(name));
         comms::Message msg;
 
-        if (sendCommandGetResponse(system::Command::GetMissionName, msg))
+        if (!result && sendCommandGetResponse(system::Command::GetMissionName, msg))
         {
-            sio::MemoryInputDevice inDev(msg.payload(), msg.getPayloadLengthBytes());
-            sio::serialisation::InputDeviceArchive in(inDev);
-            control::Command commandHeader(0u);
-            commandHeader.deserialise(in);
-            system::GetMissionNameResponse resp;
-            resp.deserialise(in);
-            if (resp.m_responseId == system::Command::GetMissionName)
+            result = parseMissionName(msg, name);
+        }
+
+        return result;
+    }
+
+    bool Mercury::parseMissionName(const comms::Message& msg, std::string &name)
+    {
+        bool result(false);
+
+        sio::MemoryInputDevice inDev(msg.payload(), msg.getPayloadLengthBytes());
+        sio::serialisation::InputDeviceArchive in(inDev);
+        control::Command commandHeader(0u);
+        commandHeader.deserialise(in);
+        system::GetMissionNameResponse resp;
+        resp.deserialise(in);
+        if (resp.m_responseId == system::Command::GetMissionName)
+        {
+            result = (commandHeader.commandId() == system::Command::Ok);
+            name.assign(reinterpret_cast<char*>(resp.m_missionName));
+            if (result)
             {
-                result = (commandHeader.commandId() == system::Command::Ok);
-                name.assign(reinterpret_cast<char*>(resp.m_missionName));
+                m_targetInfo.setMissionName(name);
             }
         }
 
         return result;
     }
 
-    bool Mercury::waitMissionInstall()
+    bool Mercury::waitMissionInstall(CancellationToken &token)
     {
         bool done(false);
         uint32_t start(board::systemTimeMs());
+        uint8_t percent(0);
         uint8_t percentPrev(255);
+        uint32_t pollDelay_ms(kInstallPollMin_ms);
 
-        while (!done && ((board::systemTimeMs() - start) <= kWaitMissionInstallTime_ms))
+        while (!done && ((board::systemTimeMs() - start) <= kWaitMissionInstallTime_ms) && isLinkUp() &&
+               !isCancelled(token))
         {
-            uint8_t percent;
-            done = isInstallComplete(percent);
+            bool replied(false);
+            done = isInstallComplete(percent, replied);
             if (done)
             {
                 log(LOG_INFO, "installation completed");
             }
-            else if (percent != percentPrev)
+            else if (!replied)
             {
-                log(LOG_INFO, "installation progress %u%%", percent);
-                percentPrev = percent;
+                // A missed poll says nothing about progress, so the last progress and ETA published stand and the next
+                // poll is just made later
+                pollDelay_ms = std::min(pollDelay_ms * 2, uint32_t(kInstallPollMax_ms));
+            }
+            else
+            {
+                // Predict completion from the average rate of progress so far and poll again part way there, backing
+                // off whilst there is no progress to predict from
+                uint32_t elapsed_ms(board::systemTimeMs() - start);
+                bool etaValid((percent > 0) && (percent < 100));
+                uint32_t remaining_ms(0);
+                if (etaValid)
+                {
+                    remaining_ms = static_cast<uint32_t>(static_cast<uint64_t>(elapsed_ms) * (100 - percent) / percent);
+                    pollDelay_ms = remaining_ms / kInstallPollDivisor;
+                }
+                else
+                {
+                    pollDelay_ms *= 2;
+                }
+                pollDelay_ms = std::max(uint32_t(kInstallPollMin_ms), std::min(pollDelay_ms, uint32_t(kInstallPollMax_ms)));
+
+                JammerStatus::instance().setInstallProgress(m_port, percent, etaValid,
+                        std::chrono::system_clock::now() + std::chrono::milliseconds(remaining_ms));
+                if (percent != percentPrev)
+                {
+                    if (etaValid)
+                    {
+                        log(LOG_INFO, "installation progress %u%%, about %u s remaining", percent, remaining_ms / 1000);
+                    }
+                    else
+                    {
+                        log(LOG_INFO, "installation progress %u%%", percent);
+                    }
+                    percentPrev = percent;
+                }
+            }
+
+            if (!done)
+            {
+                // Wake early if the mode changes so a cancellation is acted on straight away
+                uint32_t generation(token.generation);
+                (void)sapient::SapientMode::instance().waitForModeChange(generation, pollDelay_ms);
             }
         }
+        JammerStatus::instance().clearInstallProgress(m_port);
 
         if (done)
         {
             log(LOG_INFO, "mission installed");
         }
+        else if (!isLinkUp())
+        {
+            log(LOG_WARNING, "serial link lost waiting for mission installation");
+        }
+        else if (token.cancelled)
+        {
+            log(LOG_INFO, "stopped waiting for mission installation");
+        }
         else
         {
             log(LOG_WARNING, "timed out waiting for mission installation");
@@ -337,50 +729,181 @@ namespace sapient
 
 
 
-    bool Mercury::sendMessageGetResponse(const comms::Message& msg, comms::Message& resp)
+    bool Mercury::sendMessageGetResponse(const comms::Message& msg, comms::Message& resp, RttEstimator &rtt)
     {
         bool ok(false);
 
         if (m_pCommsDevice)
         {
             // Ditch any messages that are already in the buffer
-            while (m_pCommsDevice->getMessage(resp))
-            {
-            }
+            flushMessages();
 
             // Send new message
+            uint32_t start(board::systemTimeMs());
             if (m_pCommsDevice->sendMessage(msg))
             {
-                if (m_pCommsDevice->waitForMessageAvailable(m_replyTimeout_ms, [](){static_cast<sio::LinuxSerialIoDevice*>(sio::getSerialIoDevice(0))->read();}))
+                ok = receiveResponse(resp, rtt.timeout_ms());
+                if (ok)
+                {
+                    rtt.sample(board::systemTimeMs() - start);
+                }
+                else
+                {
+                    rtt.timedOut();
+                }
+            }
+        }
+
+        return ok;
+    }
+
+    bool Mercury::receiveResponse(comms::Message& resp, uint32_t timeout_ms)
+    {
+        bool ok(false);
+
+        if (m_pCommsDevice)
+        {
+            if (m_pCommsDevice->waitForMessageAvailable(timeout_ms, [this](){static_cast<sio::LinuxSerialIoDevice*>(m_pSerialIoDevice)->read();}))
+            {
+                if (m_pCommsDevice->getMessage(resp))
                 {
-                    if (m_pCommsDevice->getMessage(resp))
+                    ok = resp.isCommandMessage() && resp.getRecipient() == system::Module::MCM;
+                    if (!ok)
                     {
-                        ok = resp.isCommandMessage() && resp.getRecipient() == system::Module::MCM;
+                        log(LOG_INFO, "skipped message which is not a command reply for the MCM");
                     }
                 }
+
+                // Every reply from the target counts as proof of life
+                if (ok)
+                {
+                    m_lastResponse_ms = board::systemTimeMs();
+                    m_responseSeen = true;
+                }
             }
         }
 
         return ok;
     }
 
-    bool Mercury::sendMessageCheckOk(const comms::Message& msg)
+    bool Mercury::isLinkUp()
     {
-        comms::Message resp;
-        return sendMessageGetResponse(msg, resp) && isOkResponse(resp);
+        return m_pCommsDevice && m_pCommsDevice->getIoDevice().isGood();
+    }
+
+    void Mercury::flushMessages()
+    {
+        comms::Message msg;
+        while (m_pCommsDevice && m_pCommsDevice->getMessage(msg))
+        {
+        }
     }
 
     bool Mercury::sendCommandGetResponse(system::Command::Id cmdId, comms::Message& resp)
     {
-        control::Command cmd(cmdId);
-        return sendCommandGetResponse(cmd, resp);
+        // Replies to these commands carry the command ID so are matched rather than assumed to be the next message
+        std::vector<Transaction> transactions(1, makeTransaction(cmdId));
+        bool ok(transact(transactions, m_rttQuery));
+        if (ok)
+        {
+            resp = transactions.front().resp;
+        }
+
+        return ok;
+    }
+
+    Mercury::Transaction Mercury::makeTransaction(system::Command::Id cmdId)
+    {
+        Transaction transaction;
+        transaction.commandId = cmdId;
+        transaction.complete = false;
+        return transaction;
+    }
+
+    bool Mercury::transact(std::vector<Transaction> &transactions, RttEstimator &rtt)
+    {
+        bool ok(m_pCommsDevice != nullptr);
+        size_t pending(0);
+
+        // Nothing is outstanding so anything already in the buffer is stale
+        flushMessages();
+
+        // Send every request before waiting for any reply so that independent queries share one round trip
+        for (auto it = transactions.begin(); ok && (it != transactions.end()); ++it)
+        {
+            comms::Message msg;
+            control::makeCommandMessage(msg, control::Command(it->commandId), system::Module::MCM);
+            it->complete = false;
+            ok = m_pCommsDevice->sendMessage(msg);
+            pending++;
+        }
+
+        // Match replies to requests by command ID, replies which match no outstanding request are late replies to
+        // earlier requests and are dropped
+        uint32_t start(board::systemTimeMs());
+        uint32_t timeout_ms(rtt.timeout_ms());
+        while (ok && (pending > 0))
+        {
+            uint32_t elapsed_ms(board::systemTimeMs() - start);
+            comms::Message resp;
+            uint32_t responseId(0);
+            if (elapsed_ms >= timeout_ms)
+            {
+                rtt.timedOut();
+                ok = false;
+            }
+            else if (!receiveResponse(resp, timeout_ms - elapsed_ms))
+            {
+                // Either the wait timed out, which the next pass picks up, or a message which is not a reply from the
+                // MCM arrived and was skipped, in which case keep waiting
+                ok = isLinkUp();
+            }
+            else if (getResponseId(resp, responseId))
+            {
+                auto it(std::find_if(transactions.begin(), transactions.end(), [responseId](Transaction const &t)
+                        {
+                            return !t.complete && (static_cast<uint32_t>(t.commandId) == responseId);
+                        }));
+                if (it != transactions.end())
+                {
+                    it->resp = resp;
+                    it->complete = true;
+                    pending--;
+                    rtt.sample(board::systemTimeMs() - start);
+                }
+                else
+                {
+                    log(LOG_INFO, "dropped unexpected reply to command 0x%02x", responseId);
+                }
+            }
+        }
+
+        return ok;
     }
 
-    bool Mercury::sendCommandGetResponse(const control::Command& cmd, comms::Message& resp)
+    bool Mercury::getResponseId(const comms::Message& msg, uint32_t &responseId)
+    {
+        bool ok(msg.isCommandMessage() && (msg.getRecipient() == system::Module::MCM));
+
+        if (ok)
+        {
+            sio::MemoryInputDevice inDev(msg.payload(), msg.getPayloadLengthBytes());
+            sio::serialisation::InputDeviceArchive in(inDev);
+            control::Command commandHeader(0u);
+            commandHeader.deserialise(in);
+            system::Response resp;
+            resp.deserialise(in);
+            responseId = static_cast<uint32_t>(resp.m_responseId);
+        }
+
+        return ok;
+    }
+
+    bool Mercury::sendCommandGetResponse(const control::Command& cmd, comms::Message& resp, RttEstimator &rtt)
     {
         comms::Message msg;
         control::makeCommandMessage(msg, cmd, system::Module::MCM);
-        return sendMessageGetResponse(msg, resp);
+        return sendMessageGetResponse(msg, resp, rtt);
     }
 
     bool Mercury::sendCommandCheckOk(system::Command::Id cmdId)
@@ -389,10 +912,10 @@ namespace sapient
         return sendCommandGetResponse(cmdId, resp) && isOkResponse(resp);
     }
 
-    bool Mercury::sendCommandCheckOk(const control::Command& cmd)
+    bool Mercury::sendCommandCheckOk(const control::Command& cmd, RttEstimator &rtt)
     {
         comms::Message resp;
-        return sendCommandGetResponse(cmd, resp) && isOkResponse(resp);
+        return sendCommandGetResponse(cmd, resp, rtt) && isOkResponse(resp);
     }
 
     bool Mercury::isOkResponse(const comms::Message& msg)
@@ -413,13 +936,14 @@ namespace sapient
         return ok;
     }
 
-    bool Mercury::sendCommandCheckResponse(system::Command::Id cmdId)
+    bool Mercury::sendCommandCheckResponse(system::Command::Id cmdId, RttEstimator &rtt)
     {
         bool ok(false);
-        comms::Message msg;
+        std::vector<Transaction> transactions(1, makeTransaction(cmdId));
 
-        if (sendCommandGetResponse(cmdId, msg))
+        if (transact(transactions, rtt))
         {
+            comms::Message const &msg(transactions.front().resp);
             sio::MemoryInputDevice inDev(msg.payload(), msg.getPayloadLengthBytes());
             sio::serialisation::InputDeviceArchive in(inDev);
             control::Command commandHeader(0u);
@@ -440,14 +964,26 @@ namespace sapient
 
     bool Mercury::ping()
     {
-        return sendCommandCheckResponse(system::Command::Ping);
+        // An explicit ping is only needed if the target has been quiet for a while
+        return isRecentlyAlive() || sendCommandCheckResponse(system::Command::Ping, m_rttQuery);
     }
 
-    bool Mercury::isInstallComplete(uint8_t &percent)
+    bool Mercury::isRecentlyAlive()
+    {
+        return m_responseSeen && ((board::systemTimeMs() - m_lastResponse_ms) <= m_config.livenessQuietPeriod_ms);
+    }
+
+    int32_t Mercury::baud() const
+    {
+        return m_config.baudRates[m_baudIndex];
+    }
+
+    bool Mercury::isInstallComplete(uint8_t &percent, bool &replied)
     {
         bool result(false);
         comms::Message msg;
 
+        replied = false;
         if (sendCommandGetResponse(system::Command::GetMissionFileInstallProgress, msg))
         {
             sio::MemoryInputDevice inDev(msg.payload(), msg.getPayloadLengthBytes());
@@ -460,6 +996,7 @@ namespace sapient
             {
                 result = (commandHeader.commandId() == system::Command::NotOk);
                 percent = resp.m_percent;
+                replied = true;
             }
         }
 
@@ -471,20 +1008,30 @@ namespace sapient
         system::McmState::State state(system::McmState::Unknown);
         comms::Message msg;
 
-        if (sendCommandGetResponse(system::Command::GetState, msg))
+        if (!m_targetInfo.getState(state) && sendCommandGetResponse(system::Command::GetState, msg))
         {
-            sio::MemoryInputDevice inDev(msg.payload(), msg.getPayloadLengthBytes());
-            sio::serialisation::InputDeviceArchive in(inDev);
-            control::Command commandHeader(0u);
-            commandHeader.deserialise(in);
-            if (commandHeader.commandId() == system::Command::Ok)
+            state = parseTargetState(msg);
+        }
+
+        return state;
+    }
+
+    system::McmState::State Mercury::parseTargetState(const comms::Message& msg)
+    {
+        system::McmState::State state(system::McmState::Unknown);
+
+        sio::MemoryInputDevice inDev(msg.payload(), msg.getPayloadLengthBytes());
+        sio::serialisation::InputDeviceArchive in(inDev);
+        control::Command commandHeader(0u);
+        commandHeader.deserialise(in);
+        if (commandHeader.commandId() == system::Command::Ok)
+        {
+            system::GetStateResponse resp;
+            resp.deserialise(in);
+            if (resp.m_responseId == system::Command::GetState)
             {
-                system::GetStateResponse resp;
-                resp.deserialise(in);
-                if (resp.m_responseId == system::Command::GetState)
-                {
-                    state = resp.m_state;
-                }
+                state = resp.m_state;
+                m_targetInfo.setState(state);
             }
         }
 
@@ -493,10 +1040,11 @@ namespace sapient
 
     bool Mercury::getTargetVersion(base::Version& vers)
     {
-        bool ok(false);
+        // Version cannot change without a reconnect
+        bool ok(m_targetInfo.getVersion(vers));
         comms::Message msg;
 
-        if (sendCommandGetResponse(system::Command::GetSoftwareVersionNumber, msg))
+        if (!ok && sendCommandGetResponse(system::Command::GetSoftwareVersionNumber, msg))
         {
             sio::MemoryInputDevice inDev(msg.payload(), msg.getPayloadLengthBytes());
             sio::serialisation::InputDeviceArchive in(inDev);
@@ -512,6 +1060,7 @@ namespace sapient
                     vers.m_minor = resp.m_minorVersion;
                     vers.m_build = resp.m_buildNumber;
                     ok = true;
+                    m_targetInfo.setVersion(vers);
                     log(LOG_INFO, "detected target version %d.%d.%d", vers.m_major, vers.m_minor, vers.m_build);
                 }
             }
@@ -528,6 +1077,7 @@ namespace sapient
 
         if (getTargetVersion(targetVersion))
         {
+            m_targetVersion = targetVersion;
             result = targetVersion >= minTargetVersion;
         }
 
@@ -536,7 +1086,8 @@ namespace sapient
 
     bool Mercury::startJamming()
     {
-        bool ok(sendCommandCheckResponse(system::Command::StartJamming));
+        bool ok(sendCommandCheckResponse(system::Command::StartJamming, m_rttControl));
+        m_targetInfo.invalidate();
         if (ok)
         {
             log(LOG_INFO, "started jamming");
@@ -551,7 +1102,8 @@ namespace sapient
 
     bool Mercury::stopJamming()
     {
-        bool ok(sendCommandCheckResponse(system::Command::StopJamming));
+        bool ok(sendCommandCheckResponse(system::Command::StopJamming, m_rttControl));
+        m_targetInfo.invalidate();
         if (ok)
         {
             log(LOG_INFO, "stopped jamming");
@@ -564,39 +1116,140 @@ namespace sapient
         return ok;
     }
 
-    void Mercury::getFileSizeAndCrc(FILE *file, int32_t &size, uint16_t &crc)
+    Mercury::CancellationToken Mercury::makeCancellationToken(uint32_t mode)
     {
-        size = 0;
-        if (file)
+        CancellationToken token;
+        token.mode = mode;
+        // The generation the control loop consumed before it read the mode, not the current one, so that a mode change
+        // since then is picked up by the first isCancelled check
+        token.generation = m_modeGeneration;
+        return token;
+    }
+
+    bool Mercury::isCancelled(CancellationToken &token)
+    {
+        uint32_t generation(SapientMode::instance().modeGeneration());
+
+        if (!token.cancelled && (generation != token.generation))
+        {
+            token.generation = generation;
+            uint32_t mode(SapientMode::instance().mode());
+
+            // A newer mode which needs the same mission content does not make the work stale
+            MissionStore::ContentId wanted, latest;
+            token.cancelled = (mode != token.mode) &&
+                              ((mode == 0) ||
+                               !SapientMode::instance().getMissionContentId(token.mode, wanted) ||
+                               !SapientMode::instance().getMissionContentId(mode, latest) ||
+                               (wanted != latest));
+            if (token.cancelled)
+            {
+                log(LOG_INFO, "mode changed from %u to %u, abandoning stale work", token.mode, mode);
+            }
+        }
+
+        return token.cancelled;
+    }
+
+    void Mercury::log(int pri, const char *fmt, ...) const
+    {
+        // Leave room for the prefix in the buffer used by ::log
+        char str[896];
+        va_list args;
+        va_start(args, fmt);
+        vsnprintf(str, sizeof(str), fmt, args);
+        va_end(args);
+        ::log(pri, "%s: %s", m_port.c_str(), str);
+    }
+
+    void Mercury::setNoResponse()
+    {
+        // The target may have restarted, or been replaced, whilst it was not responding so nothing cached about it
+        // can be trusted
+        m_state = state::NoResponse;
+        m_targetInfo.reset();
+    }
+
+    void Mercury::logTargetInfoCache()
+    {
+        log(LOG_INFO, "target info cache: %u hits (round trips saved), %u misses", m_targetInfo.hits(),
+            m_targetInfo.misses());
+    }
+
+    bool Mercury::isMissionInstalled(uint32_t mode, std::string const &installedName)
+    {
+        bool installed(false);
+        MissionStore::ContentId wanted, loaded;
+
+        if (SapientMode::instance().getMissionContentId(mode, wanted))
         {
-            ::fseek(file, 0L, SEEK_END);
-            size = ::ftell(file);
-            ::fseek(file, 0L, SEEK_SET);
+            // Prefer the content we know we installed as the file with the installed name may have changed since
+            if (m_loadedMission && (installedName == m_loadedMissionName))
+            {
+                installed = (m_loadedMission->contentId() == wanted);
+            }
+            else if (SapientMode::instance().getMissionContentId(installedName, loaded))
+            {
+                // Different names with byte-identical content do not need a reload
+                installed = (loaded == wanted);
+            }
         }
         else
         {
-            log(LOG_ERR, "failed to open file");
+            // Mission file not available, fall back to comparing names
+            std::string sapientMission;
+            SapientMode::instance().getMissionName(mode, sapientMission);
+            installed = (sapientMission == installedName);
         }
 
-        if (size > 0)
+        return installed;
+    }
+
+    void Mercury::readInstalledMission()
+    {
+        FILE *file(::fopen(m_installedFileName.c_str(), "r"));
+
+        if (file)
         {
-            // Get mission CRC before sending as MCM expects the verify CRC command in quick succession
-            // after the last data packet
-            base::Crc16 crc16;
-            for (int32_t i = 0; i < size;)
+            // Single line: <size> <crc> <hash> <name reported by the target>
+            char line[512];
+            std::shared_ptr<MissionStore::Mission> mission(std::make_shared<MissionStore::Mission>());
+            unsigned int crc(0);
+            int pos(0);
+            if (::fgets(line, sizeof(line), file) &&
+                (::sscanf(line, "%" SCNd32 " %x %" SCNx64 " %n", &mission->size, &crc, &mission->hash, &pos) == 3) &&
+                (pos > 0))
             {
-                uint8_t buffer[1024];
-                size_t n(::fread(buffer, 1, sizeof(buffer), file));
-                crc16.write(buffer, n);
-                i += n;
+                std::string name(line + pos);
+                while (!name.empty() && ((name.back() == '\n') || (name.back() == '\r')))
+                {
+                    name.pop_back();
+                }
+                mission->crc = static_cast<uint16_t>(crc);
+                m_loadedMission = mission;
+                m_loadedMissionName = name;
+                log(LOG_INFO, "last verified install %s (%d bytes, crc 0x%04x)", name.c_str(), mission->size, mission->crc);
             }
-            crc = crc16.read();
-            ::fseek(file, 0L, SEEK_SET);
+            ::fclose(file);
         }
-        else
+    }
+
+    void Mercury::writeInstalledMission()
+    {
+        std::string tempName(m_installedFileName + ".tmp");
+        FILE *file(::fopen(tempName.c_str(), "w"));
+        bool ok(file != nullptr);
+
+        if (ok)
         {
-            log(LOG_WARNING, "empty file");
+            ::fprintf(file, "%" PRId32 " %04x %016" PRIx64 " %s\n", m_loadedMission->size, m_loadedMission->crc,
+                      m_loadedMission->hash, m_loadedMissionName.c_str());
+            ok = (::fclose(file) == 0);
+        }
+
+        if (!ok || (::rename(tempName.c_str(), m_installedFileName.c_str()) != 0))
+        {
+            log(LOG_WARNING, "failed to record installed mission in %s", m_installedFileName.c_str());
         }
     }
 } /* namespace sapient */
-
@@ -273,6 +273,16 @@ bool SapientMessageHeartbeat::serialise(char *buffer)
     root->append_node(sys);
     root->append_node(inf);
 
+    // Status node
+    if (!m_installStatus.empty())
+    {
+        rapidxml::xml_node<>* sts = m_doc.allocate_node(rapidxml::node_element, "status");
+        sts->append_attribute(m_doc.allocate_attribute("level", "Information"));
+        sts->append_attribute(m_doc.allocate_attribute("type", "Mission Install"));
+        sts->append_attribute(m_doc.allocate_attribute("value", m_installStatus.c_str()));
+        root->append_node(sts);
+    }
+
     // Generate output string
     return SapientMessage::serialise(buffer) && result;
 }
@@ -0,0 +1,186 @@
+#include "fastcrc16.hpp"
+#include "debuglog.hpp"
+
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+namespace sapient
+{
+    const FastCrc16::Variant FastCrc16::kVariants[] =
+    {
+        {"CCITT-FALSE", 0x1021, 0xffff, 0x0000, false},
+        {"XMODEM",      0x1021, 0x0000, 0x0000, false},
+        {"GENIBUS",     0x1021, 0xffff, 0xffff, false},
+        {"KERMIT",      0x8408, 0x0000, 0x0000, true},
+        {"X-25",        0x8408, 0xffff, 0xffff, true},
+        {"MCRF4XX",     0x8408, 0xffff, 0x0000, true},
+        {"ARC",         0xa001, 0x0000, 0x0000, true},
+        {"MODBUS",      0xa001, 0xffff, 0x0000, true},
+        {"BUYPASS",     0x8005, 0x0000, 0x0000, false}
+    };
+    const size_t FastCrc16::kNumVariants = sizeof(kVariants) / sizeof(kVariants[0]);
+
+    bool FastCrc16::s_accelerated(false);
+    FastCrc16::Variant FastCrc16::s_variant;
+    FastCrc16::Tables FastCrc16::s_tables;
+
+    namespace
+    {
+        std::once_flag calibrated;
+    }
+
+    FastCrc16::FastCrc16()
+    {
+        std::call_once(calibrated, &FastCrc16::calibrate);
+        reset();
+    }
+
+    void FastCrc16::write(uint8_t b)
+    {
+        write(&b, 1);
+    }
+
+    void FastCrc16::write(const uint8_t *data, size_t size)
+    {
+        if (s_accelerated)
+        {
+            m_crc = compute(m_crc, data, size);
+        }
+        else
+        {
+            m_fallback.write(data, size);
+        }
+    }
+
+    uint16_t FastCrc16::read() const
+    {
+        return s_accelerated ? static_cast<uint16_t>(m_crc ^ s_variant.xorOut) : m_fallback.read();
+    }
+
+    void FastCrc16::reset()
+    {
+        m_crc = s_variant.init;
+        m_fallback = mercury::embedded::base::Crc16();
+    }
+
+    void FastCrc16::calibrate()
+    {
+        // Check vector covers the standard check string, a block which is not a multiple of eight bytes and
+        // data split across several writes
+        std::vector<uint8_t> data(1000);
+        uint32_t seed(0x12345678);
+        for (auto &b : data)
+        {
+            seed = seed * 1103515245 + 12345;
+            b = static_cast<uint8_t>(seed >> 16);
+        }
+        const char *check("123456789");
+        const size_t checkSize(::strlen(check));
+
+        mercury::embedded::base::Crc16 ref;
+        ref.write(reinterpret_cast<const uint8_t *>(check), checkSize);
+        const uint16_t refCheck(ref.read());
+        ref.write(data.data(), 3);
+        ref.write(data.data() + 3, data.size() - 3);
+        const uint16_t refData(ref.read());
+
+        for (size_t i = 0; (i < kNumVariants) && !s_accelerated; i++)
+        {
+            Variant const &variant(kVariants[i]);
+            buildTables(variant);
+
+            uint16_t crc(compute(variant.init, reinterpret_cast<const uint8_t *>(check), checkSize));
+            if (static_cast<uint16_t>(crc ^ variant.xorOut) == refCheck)
+            {
+                crc = compute(crc, data.data(), 3);
+                crc = compute(crc, data.data() + 3, data.size() - 3);
+                if (static_cast<uint16_t>(crc ^ variant.xorOut) == refData)
+                {
+                    s_variant = variant;
+                    s_accelerated = true;
+                }
+            }
+        }
+
+        if (s_accelerated)
+        {
+            log(LOG_INFO, "using slicing-by-8 CRC16 (%s)", s_variant.name);
+        }
+        else
+        {
+            log(LOG_WARNING, "CRC16 variant not recognised (check 0x%04x), using base CRC16", refCheck);
+        }
+    }
+
+    void FastCrc16::buildTables(Variant const &variant)
+    {
+        for (uint32_t b = 0; b < 256; b++)
+        {
+            uint16_t crc;
+            if (variant.reflected)
+            {
+                crc = static_cast<uint16_t>(b);
+                for (int bit = 0; bit < 8; bit++)
+                {
+                    crc = (crc & 1) ? static_cast<uint16_t>((crc >> 1) ^ variant.poly) : static_cast<uint16_t>(crc >> 1);
+                }
+            }
+            else
+            {
+                crc = static_cast<uint16_t>(b << 8);
+                for (int bit = 0; bit < 8; bit++)
+                {
+                    crc = (crc & 0x8000) ? static_cast<uint16_t>((crc << 1) ^ variant.poly) : static_cast<uint16_t>(crc << 1);
+                }
+            }
+            s_tables[0][b] = crc;
+        }
+
+        // Table k gives the CRC of a byte followed by k zero bytes
+        for (size_t k = 1; k < s_tables.size(); k++)
+        {
+            for (uint32_t b = 0; b < 256; b++)
+            {
+                uint16_t prev(s_tables[k - 1][b]);
+                s_tables[k][b] = variant.reflected ?
+                        static_cast<uint16_t>((prev >> 8) ^ s_tables[0][prev & 0xff]) :
+                        static_cast<uint16_t>((prev << 8) ^ s_tables[0][prev >> 8]);
+            }
+        }
+        s_variant = variant;
+    }
+
+    uint16_t FastCrc16::compute(uint16_t crc, const uint8_t *data, size_t size)
+    {
+        Tables const &t(s_tables);
+
+        // The CRC register is folded into the first two bytes of each block of eight
+        if (s_variant.reflected)
+        {
+            for (; size >= 8; size -= 8, data += 8)
+            {
+                crc = t[7][data[0] ^ (crc & 0xff)] ^ t[6][data[1] ^ (crc >> 8)] ^ t[5][data[2]] ^ t[4][data[3]] ^
+                      t[3][data[4]] ^ t[2][data[5]] ^ t[1][data[6]] ^ t[0][data[7]];
+            }
+            for (; size > 0; size--, data++)
+            {
+                crc = static_cast<uint16_t>((crc >> 8) ^ t[0][(crc ^ *data) & 0xff]);
+            }
+        }
+        else
+        {
+            for (; size >= 8; size -= 8, data += 8)
+            {
+                crc = t[7][data[0] ^ (crc >> 8)] ^ t[6][data[1] ^ (crc & 0xff)] ^ t[5][data[2]] ^ t[4][data[3]] ^
+                      t[3][data[4]] ^ t[2][data[5]] ^ t[1][data[6]] ^ t[0][data[7]];
+            }
+            for (; size > 0; size--, data++)
+            {
+                crc = static_cast<uint16_t>((crc << 8) ^ t[0][(crc >> 8) ^ *data]);
+            }
+        }
+
+        return crc;
+    }
+}
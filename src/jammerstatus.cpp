@@ -0,0 +1,56 @@
+#include "jammerstatus.hpp"
+
+#include <algorithm>
+
+namespace sapient
+{
+    JammerStatus &JammerStatus::instance()
+    {
+        static JammerStatus s;
+        return s;
+    }
+
+    void JammerStatus::setInstallProgress(std::string const &port, uint8_t percent, bool etaValid, TimePoint eta)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it(m_installs.find(port));
+        if ((it == m_installs.end()) || (percent != it->second.percent) || (etaValid != it->second.etaValid))
+        {
+            m_revision++;
+        }
+        InstallProgress &install(m_installs[port]);
+        install.percent = percent;
+        install.etaValid = etaValid;
+        install.eta = eta;
+    }
+
+    void JammerStatus::clearInstallProgress(std::string const &port)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_installs.erase(port) > 0)
+        {
+            m_revision++;
+        }
+    }
+
+    bool JammerStatus::getInstallProgress(uint8_t &percent, bool &etaValid, TimePoint &eta)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        percent = 100;
+        etaValid = !m_installs.empty();
+        eta = TimePoint();
+        for (auto const &install : m_installs)
+        {
+            percent = std::min(percent, install.second.percent);
+            etaValid = etaValid && install.second.etaValid;
+            eta = std::max(eta, install.second.eta);
+        }
+        return !m_installs.empty();
+    }
+
+    uint32_t JammerStatus::revision()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_revision;
+    }
+}
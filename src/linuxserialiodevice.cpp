@@ -3,6 +3,10 @@
 #include "board/boardlib/inc/system.hpp"
 #include "debuglog.hpp"
 
+#include <map>
+#include <memory>
+#include <mutex>
+
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/signal.h>
@@ -27,15 +31,25 @@ namespace mercury
 
             SerialIoDevice* getSerialIoDevice(std::string const &node)
             {
-                static LinuxSerialIoDevice instance(node);
+                // One device per node, created on first use and kept for the life of the process
+                static std::mutex mutex;
+                static std::map<std::string, std::unique_ptr<LinuxSerialIoDevice>> devices;
 
-                return &instance;
+                std::lock_guard<std::mutex> lock(mutex);
+                std::unique_ptr<LinuxSerialIoDevice> &device(devices[node]);
+                if (!device)
+                {
+                    device.reset(new LinuxSerialIoDevice(node));
+                }
+
+                return device.get();
             }
 
             LinuxSerialIoDevice::LinuxSerialIoDevice(std::string const &node)
                 : m_node(node),
                   m_fd(-1),
-                  m_isGood(false)
+                  m_isGood(false),
+                  m_baud(115200)
             {
                 reinitialise();
             }
@@ -90,10 +104,17 @@ namespace mercury
                 }
                 else
                 {
-                    m_isGood = installSignalHandler() && setInterfaceAttribs(m_fd, B115200, 0);
+                    speed_t speed(B115200);
+                    if (!getSpeed(baud, speed))
+                    {
+                        log(LOG_ERR, "unsupported baud rate %d, using 115200", baud);
+                        baud = 115200;
+                    }
+                    m_baud = baud;
+                    m_isGood = installSignalHandler() && setInterfaceAttribs(m_fd, speed, 0);
                     if (m_isGood)
                     {
-                        log(LOG_INFO, "opened %s", m_node.c_str());
+                        log(LOG_INFO, "opened %s at %d baud", m_node.c_str(), m_baud);
                     }
                     else
                     {
@@ -102,6 +123,47 @@ namespace mercury
                 }
             }
 
+            int32_t LinuxSerialIoDevice::baud() const
+            {
+                return m_baud;
+            }
+
+            bool LinuxSerialIoDevice::getSpeed(int32_t baud, speed_t &speed)
+            {
+                bool ok(true);
+
+                switch (baud)
+                {
+                case 9600: speed = B9600; break;
+                case 19200: speed = B19200; break;
+                case 38400: speed = B38400; break;
+                case 57600: speed = B57600; break;
+                case 115200: speed = B115200; break;
+                case 230400: speed = B230400; break;
+#ifdef B460800
+                case 460800: speed = B460800; break;
+#endif
+#ifdef B921600
+                case 921600: speed = B921600; break;
+#endif
+#ifdef B1000000
+                case 1000000: speed = B1000000; break;
+#endif
+#ifdef B1500000
+                case 1500000: speed = B1500000; break;
+#endif
+#ifdef B2000000
+                case 2000000: speed = B2000000; break;
+#endif
+#ifdef B3000000
+                case 3000000: speed = B3000000; break;
+#endif
+                default: ok = false; break;
+                }
+
+                return ok;
+            }
+
             void LinuxSerialIoDevice::read()
             {
                 char buf[255];
@@ -141,7 +203,7 @@ namespace mercury
             {
             }
 
-            bool LinuxSerialIoDevice::setInterfaceAttribs(int fd, int speed, bool parity)
+            bool LinuxSerialIoDevice::setInterfaceAttribs(int fd, speed_t speed, bool parity)
             {
                 bool ok(false);
                 termios tty;
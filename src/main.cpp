@@ -2,9 +2,14 @@
 #include <cstdio>
 #include <cinttypes>
 #include <cstring>
+#include <string>
+#include <vector>
 
 #include "debuglog.hpp"
+#include "linuxserialiodevice.hpp"
 #include "mercury.hpp"
+#include "missionstore.hpp"
+#include "sharedmissioncache.hpp"
 #include "sapient.hpp"
 #include "sapientmode.hpp"
 #include "version.hpp"
@@ -14,14 +19,22 @@ int main(int argc, char *argv[])
     printf("SAPIENT Mediator (KT-956-0186-00) Version: %s\n\n", sapient::kVersionString.c_str());
     if (argc < 2)
     {
-        printf("Usage: %s <server-ip> [<server-port>] [<serial-dev>]\ne.g.   %s 127.0.0.1 14006 /dev/ttyUSB0\n\n",argv[0], argv[0]);
+        printf("Usage: %s <server-ip> [<server-port>] [<serial-dev>[,<serial-dev>...]] [-d] [-s <shm-name>] [-p <ms>] [-q <ms>] [-b <baud>[,<baud>...]] [-w]\ne.g.   %s 127.0.0.1 14006 /dev/ttyUSB0,/dev/ttyUSB1\n\n",argv[0], argv[0]);
+        printf("  -d             use debug message terminator\n");
+        printf("  -s <shm-name>  share mission cache with other mediators on this host e.g. /sapient-missions\n");
+        printf("  -p <ms>        jammer health check period (default %u ms)\n", sapient::Mercury::kHealthCheckPeriodDefault_ms);
+        printf("  -q <ms>        ping jammer after this long without a reply (default %u ms)\n", sapient::Mercury::kLivenessQuietPeriodDefault_ms);
+        printf("  -b <baud>,...  serial baud rates to try, fastest first (default %d)\n", sapient::Mercury::kBaudDefault);
+        printf("  -w             keep several data messages in flight when uploading (experimental)\n\n");
     }
     else
     {
-        std::string serialPort("/dev/ttyUSB0");
+        std::vector<std::string> serialPorts;
         uint16_t serverPort(14006);
         std::string ipAddress(argv[1]);
         bool debugTerminator(false);
+        std::string sharedCacheName;
+        sapient::Mercury::Config mercuryConfig;
 
         if (argc >= 3)
         {
@@ -29,27 +42,106 @@ int main(int argc, char *argv[])
         }
         if (argc >= 4)
         {
-            serialPort = argv[3];
+            // One jammer per serial port
+            for (char *port = ::strtok(argv[3], ","); port; port = ::strtok(nullptr, ","))
+            {
+                serialPorts.push_back(port);
+            }
+        }
+        if (serialPorts.empty())
+        {
+            serialPorts.push_back("/dev/ttyUSB0");
         }
-        if (argc >= 5)
+        for (int i = 4; i < argc; ++i)
         {
-            if (::strcmp(argv[4], "-d") == 0)
+            if (::strcmp(argv[i], "-d") == 0)
             {
                 debugTerminator = true;
                 log(LOG_INFO, "using debug terminator");
             }
+            else if ((::strcmp(argv[i], "-s") == 0) && ((i + 1) < argc))
+            {
+                sharedCacheName = argv[++i];
+            }
+            else if ((::strcmp(argv[i], "-p") == 0) && ((i + 1) < argc))
+            {
+                sscanf(argv[++i], "%" SCNu32, &mercuryConfig.healthCheckPeriod_ms);
+            }
+            else if ((::strcmp(argv[i], "-q") == 0) && ((i + 1) < argc))
+            {
+                sscanf(argv[++i], "%" SCNu32, &mercuryConfig.livenessQuietPeriod_ms);
+            }
+            else if (::strcmp(argv[i], "-w") == 0)
+            {
+                mercuryConfig.windowedUpload = true;
+                log(LOG_INFO, "using windowed upload");
+            }
+            else if ((::strcmp(argv[i], "-b") == 0) && ((i + 1) < argc))
+            {
+                mercuryConfig.baudRates.clear();
+                for (char *rate = ::strtok(argv[++i], ","); rate; rate = ::strtok(nullptr, ","))
+                {
+                    // The serial port would silently fall back to its default for a rate it does not support
+                    int32_t baud(::atoi(rate));
+                    speed_t speed;
+                    if (mercury::embedded::sio::LinuxSerialIoDevice::getSpeed(baud, speed))
+                    {
+                        mercuryConfig.baudRates.push_back(baud);
+                    }
+                    else
+                    {
+                        log(LOG_WARNING, "ignoring unsupported baud rate %s", rate);
+                    }
+                }
+            }
         }
 
         openlog("sapient", 0, 0);
 
-        // Check mission files exist, called function logs warnings if not
-        (void)sapient::SapientMode::instance().doMissionFilesExist();
+        // Load task mode to mission mapping, built-in mapping is used if there is no mode map file
+        (void)sapient::SapientMode::instance().loadModeMap("modemap.cfg");
 
-        // Start threads
-        std::thread threadMercury(sapient::Mercury(), serialPort);
+        // Start threads, the mission library is loaded in the background so that SAPIENT registration does not wait
+        std::thread threadMissionStore([sharedCacheName]()
+        {
+            std::string const &location(sapient::SapientMode::instance().missionFileLocation());
+
+            // Start with the missions another mediator on this host has already validated
+            if (!sharedCacheName.empty())
+            {
+                (void)sapient::SharedMissionCache::instance().attach(sharedCacheName);
+            }
+
+            // Load mission index, only missions which have changed since the index was written are validated
+            sapient::MissionStore::instance().load(location);
+
+            if (!sharedCacheName.empty())
+            {
+                (void)sapient::SharedMissionCache::instance().populate(sharedCacheName, location);
+            }
+
+            // Check mission files exist, called function logs warnings if not
+            (void)sapient::SapientMode::instance().doMissionFilesExist();
+
+            // Mission changes wake the Mercury controllers so that an edited mission for the current mode is reinstalled
+            sapient::MissionStore::instance().watch(location, []()
+            {
+                sapient::SapientMode::instance().notifyMissionsChanged();
+            });
+        });
+        // Each jammer has its own controller, all of them act on a mode change so missions are uploaded in parallel
+        std::vector<std::thread> threadsMercury;
+        for (auto const &serialPort : serialPorts)
+        {
+            threadsMercury.emplace_back(sapient::Mercury(mercuryConfig), serialPort);
+        }
         std::thread threadSapient(sapient::Sapient(), ipAddress, serverPort, debugTerminator);
 
-        threadMercury.join();
+        threadMissionStore.join();
+        for (auto &threadMercury : threadsMercury)
+        {
+            threadMercury.join();
+        }
         threadSapient.join();
         log(LOG_INFO, "exiting");
     }
@@ -0,0 +1,145 @@
+#include "missionframes.hpp"
+#include "sharedmissioncache.hpp"
+#include "debuglog.hpp"
+#include "board.hpp"
+
+#include "control/controllib/inc/commandfunctions.hpp"
+#include "control/controllib/inc/datahandler.hpp"
+#include "system/systemlib/inc/mcmcommands.hpp"
+#include "system/systemlib/inc/moduleids.hpp"
+
+#include <algorithm>
+#include <cstdio>
+
+using namespace mercury::embedded;
+
+namespace sapient
+{
+    MissionFrames &MissionFrames::instance()
+    {
+        static MissionFrames s;
+        return s;
+    }
+
+    bool MissionFrames::getFrames(std::string const &fileName, MissionStore::Mission const &mission, FramesPtr &frames)
+    {
+        bool ok(true);
+        MissionStore::ContentId id(mission.contentId());
+
+        // Held whilst building so that jammers uploading the same content build it once between them
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto it(m_entries.find(id));
+        if (it == m_entries.end())
+        {
+            std::shared_ptr<Frames> built(std::make_shared<Frames>());
+            uint32_t start(board::systemTimeMs());
+            ok = build(fileName, mission, *built);
+            if (ok)
+            {
+                log(LOG_INFO, "built %u data messages for %s in %u ms", uint32_t(built->data.size()),
+                    fileName.c_str(), board::systemTimeMs() - start);
+
+                if (m_entries.size() >= kMaxCachedContents)
+                {
+                    auto oldest(std::min_element(m_entries.begin(), m_entries.end(),
+                            [](std::pair<const MissionStore::ContentId, Entry> const &a,
+                               std::pair<const MissionStore::ContentId, Entry> const &b)
+                            { return a.second.lastUsed < b.second.lastUsed; }));
+                    m_entries.erase(oldest);
+                }
+                it = m_entries.insert(std::make_pair(id, Entry())).first;
+                it->second.frames = built;
+            }
+        }
+
+        if (ok)
+        {
+            it->second.lastUsed = ++m_useCount;
+            frames = it->second.frames;
+        }
+
+        return ok;
+    }
+
+    bool MissionFrames::build(std::string const &fileName, MissionStore::Mission const &mission, Frames &frames)
+    {
+        bool ok(false);
+        const uint8_t *content(nullptr);
+        std::vector<uint8_t> buffer;
+
+        // Build from the shared mission cache if it holds this content, otherwise read the file
+        if (SharedMissionCache::instance().getContent(mission.contentId(), content))
+        {
+            ok = true;
+        }
+        else if (readContent(fileName, mission, buffer))
+        {
+            content = buffer.data();
+            ok = true;
+        }
+
+        if (ok)
+        {
+            const uint32_t size(static_cast<uint32_t>(mission.size));
+            frames.contentId = mission.contentId();
+            frames.data.reserve((size + kChunkSize - 1) / kChunkSize);
+
+            uint32_t offset(0);
+            uint16_t seq(0);
+            while (ok && (offset < size))
+            {
+                Frame frame;
+                uint32_t numBytes(std::min(uint32_t(kChunkSize), size - offset));
+                frame.bytes = control::DataSender::makeDataMessage(frame.msg, seq++, content + offset, numBytes,
+                                                                   system::Module::MCM);
+                ok = (frame.bytes > 0);
+                offset += frame.bytes;
+                frames.data.push_back(frame);
+            }
+
+            if (ok)
+            {
+                system::VerifyMissionFileCrcCommand cmd(mission.crc);
+                control::makeCommandMessage(frames.crc, cmd, system::Module::MCM);
+            }
+            else
+            {
+                log(LOG_ERR, "failed to make data message at offset %u of %s", offset, fileName.c_str());
+            }
+        }
+
+        return ok;
+    }
+
+    bool MissionFrames::readContent(std::string const &fileName, MissionStore::Mission const &mission,
+                                    std::vector<uint8_t> &buffer)
+    {
+        bool ok(false);
+        FILE *file(::fopen(fileName.c_str(), "rb"));
+
+        if (file)
+        {
+            // Read one byte more than expected so that a file which has grown is noticed
+            buffer.resize(static_cast<size_t>(mission.size) + 1);
+            size_t numBytes(::fread(buffer.data(), 1, buffer.size(), file));
+            ::fclose(file);
+
+            // Only build from content which still matches the validated entry, otherwise the messages would be cached
+            // under the wrong content ID
+            buffer.resize(std::min(numBytes, buffer.size() - 1));
+            ok = (numBytes == static_cast<size_t>(mission.size)) &&
+                 (MissionStore::contentHash(buffer.data(), buffer.size()) == mission.hash);
+            if (!ok)
+            {
+                log(LOG_ERR, "%s has changed since it was validated", fileName.c_str());
+            }
+        }
+        else
+        {
+            log(LOG_ERR, "failed to open file");
+        }
+
+        return ok;
+    }
+}
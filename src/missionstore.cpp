@@ -0,0 +1,517 @@
+#include "missionstore.hpp"
+#include "sharedmissioncache.hpp"
+#include "debuglog.hpp"
+#include "fastcrc16.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+namespace sapient
+{
+    MissionStore &MissionStore::instance()
+    {
+        static MissionStore s;
+        return s;
+    }
+
+    void MissionStore::load(std::string const &directory)
+    {
+        uint32_t numIndexed(0);
+        uint32_t numValidated(0);
+        uint32_t numDistinct(0);
+        std::map<std::string, MissionPtr> known;
+        std::map<std::string, MissionPtr> missions;
+        std::vector<std::shared_ptr<Mission>> pending;
+
+        // Trust entries already in the store, or the index file or shared cache on first load
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            known = m_missions;
+        }
+        if (known.empty())
+        {
+            readIndex(directory, known);
+        }
+        if (known.empty())
+        {
+            // Another mediator on this host may already have validated the library
+            (void)SharedMissionCache::instance().getMissions(directory, known);
+        }
+
+        DIR *dir(::opendir(directory.c_str()));
+        if (!dir)
+        {
+            log(LOG_WARNING, "failed to open %s", directory.c_str());
+        }
+        else
+        {
+            dirent *ent;
+            while ((ent = ::readdir(dir)) != nullptr)
+            {
+                // Skip hidden files, including the index file
+                std::string fileName(directory + ent->d_name);
+                struct stat st;
+                if ((ent->d_name[0] != '.') && (::stat(fileName.c_str(), &st) == 0) && S_ISREG(st.st_mode))
+                {
+                    auto it(known.find(fileName));
+                    if ((it != known.end()) && isCurrent(*it->second, st))
+                    {
+                        missions[fileName] = it->second;
+                        ++numIndexed;
+                    }
+                    else
+                    {
+                        std::shared_ptr<Mission> entry(std::make_shared<Mission>());
+                        entry->fileName = fileName;
+                        pending.push_back(entry);
+                    }
+                }
+            }
+            ::closedir(dir);
+        }
+
+        // Validate new and changed files in parallel as reading and CRCing them dominates startup time
+        numValidated = pending.size();
+        std::vector<uint8_t> valid(validateAll(pending));
+        for (size_t i = 0; i < pending.size(); ++i)
+        {
+            if (valid[i])
+            {
+                missions[pending[i]->fileName] = pending[i];
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if ((numValidated > 0) || (missions.size() != m_missions.size()))
+            {
+                m_indexDirty = true;
+            }
+            m_missions.swap(missions);
+            rebuildContents();
+            ++m_revision;
+            numDistinct = m_contents.size();
+        }
+
+        log(LOG_INFO, "%u missions in %s (%u from index, %u validated, %u distinct)",
+            numIndexed + numValidated, directory.c_str(), numIndexed, numValidated, numDistinct);
+
+        writeIndex(directory);
+    }
+
+    void MissionStore::watch(std::string directory, std::function<void()> changed)
+    {
+        while (true)
+        {
+            int fd(::inotify_init1(IN_CLOEXEC));
+            int wd(-1);
+
+            if (fd < 0)
+            {
+                log(LOG_ERR, "inotify_init1 failed (%d)", errno);
+            }
+            else
+            {
+                wd = ::inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM |
+                                                                IN_DELETE | IN_DELETE_SELF | IN_MOVE_SELF);
+                if (wd < 0)
+                {
+                    log(LOG_WARNING, "failed to watch %s", directory.c_str());
+                }
+            }
+
+            if (wd >= 0)
+            {
+                log(LOG_INFO, "watching %s for mission changes", directory.c_str());
+
+                // Files may have changed whilst the directory was not being watched
+                uint32_t notified(m_revision);
+                load(directory);
+
+                bool watching(true);
+                while (watching)
+                {
+                    alignas(inotify_event) char buffer[kEventBufferSize];
+                    ssize_t n(::read(fd, buffer, sizeof(buffer)));
+
+                    // Reads are interrupted by the SIGIO used by the serial port
+                    if ((n < 0) && (errno == EINTR))
+                    {
+                        continue;
+                    }
+                    else if (n <= 0)
+                    {
+                        log(LOG_ERR, "inotify read failed (%d)", errno);
+                        watching = false;
+                    }
+
+                    for (char *p = buffer; p < buffer + n;)
+                    {
+                        const inotify_event *event(reinterpret_cast<const inotify_event*>(p));
+
+                        if (event->mask & IN_Q_OVERFLOW)
+                        {
+                            log(LOG_WARNING, "inotify queue overflow, re-scanning missions");
+                            load(directory);
+                        }
+                        else if (event->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF))
+                        {
+                            log(LOG_WARNING, "%s no longer being watched", directory.c_str());
+                            watching = false;
+                        }
+                        else if ((event->len > 0) && (event->name[0] != '.'))
+                        {
+                            std::string fileName(directory + event->name);
+                            if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+                            {
+                                update(fileName);
+                            }
+                            else if (event->mask & (IN_DELETE | IN_MOVED_FROM))
+                            {
+                                remove(fileName);
+                            }
+                        }
+
+                        p += sizeof(inotify_event) + event->len;
+                    }
+
+                    writeIndex(directory);
+
+                    // Let the controllers know so that a changed mission for the current mode is reinstalled
+                    if (changed && (m_revision != notified))
+                    {
+                        notified = m_revision;
+                        changed();
+                    }
+                }
+            }
+
+            if (fd >= 0)
+            {
+                ::close(fd);
+            }
+
+            // Wait before attempting to watch the directory again
+            ::sleep(kWatchRetryTime_s);
+        }
+    }
+
+    bool MissionStore::getMission(std::string const &fileName, MissionPtr &mission)
+    {
+        bool ok(false);
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto it(m_missions.find(fileName));
+            if (it != m_missions.end())
+            {
+                mission = it->second;
+                ok = true;
+            }
+        }
+
+        if (!ok)
+        {
+            ok = refresh(fileName, mission);
+        }
+
+        return ok;
+    }
+
+    bool MissionStore::hasMission(std::string const &fileName)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return (m_missions.find(fileName) != m_missions.end());
+    }
+
+    void MissionStore::getMissions(std::vector<MissionPtr> &missions)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        missions.clear();
+        for (auto const &entry : m_missions)
+        {
+            missions.push_back(entry.second);
+        }
+    }
+
+    bool MissionStore::getContentId(std::string const &fileName, ContentId &id)
+    {
+        bool ok(false);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it(m_missions.find(fileName));
+        if (it != m_missions.end())
+        {
+            id = it->second->contentId();
+            ok = true;
+        }
+        return ok;
+    }
+
+    bool MissionStore::getContent(ContentId const &id, MissionPtr &mission)
+    {
+        bool ok(false);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it(m_contents.find(id));
+        if (it != m_contents.end())
+        {
+            mission = it->second;
+            ok = true;
+        }
+        return ok;
+    }
+
+    bool MissionStore::refresh(std::string const &fileName, MissionPtr &mission)
+    {
+        // Validate outside the lock so that lookups are not held up by file reads
+        std::shared_ptr<Mission> entry(std::make_shared<Mission>());
+        bool ok(validate(fileName, *entry));
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (ok)
+        {
+            m_missions[fileName] = entry;
+            mission = entry;
+        }
+        else
+        {
+            m_missions.erase(fileName);
+            mission.reset();
+        }
+        rebuildContents();
+        ++m_revision;
+        m_indexDirty = true;
+
+        return ok;
+    }
+
+    bool MissionStore::isCurrent(Mission const &mission, struct stat const &st)
+    {
+        return (st.st_size == mission.size) && (modificationTime(st) == mission.mtime);
+    }
+
+    void MissionStore::update(std::string const &fileName)
+    {
+        MissionPtr mission;
+        if (refresh(fileName, mission))
+        {
+            log(LOG_INFO, "mission %s changed (%d bytes, crc 0x%04x)", fileName.c_str(), mission->size, mission->crc);
+        }
+    }
+
+    void MissionStore::remove(std::string const &fileName)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_missions.erase(fileName) > 0)
+        {
+            log(LOG_INFO, "mission %s removed", fileName.c_str());
+            rebuildContents();
+            ++m_revision;
+            m_indexDirty = true;
+        }
+    }
+
+    void MissionStore::rebuildContents()
+    {
+        // Called with m_mutex held, the library is small enough to rebuild on every change
+        m_contents.clear();
+        for (auto const &entry : m_missions)
+        {
+            m_contents.insert(std::make_pair(entry.second->contentId(), entry.second));
+        }
+    }
+
+    void MissionStore::readIndex(std::string const &directory, std::map<std::string, MissionPtr> &missions) const
+    {
+        std::string indexName(directory + kIndexFileName);
+        FILE *file(::fopen(indexName.c_str(), "r"));
+
+        if (!file)
+        {
+            log(LOG_INFO, "no mission index %s", indexName.c_str());
+        }
+        else
+        {
+            // Each line is: <size> <mtime> <crc> <hash> <name>, name last as it may contain spaces
+            char line[512];
+            while (::fgets(line, sizeof(line), file))
+            {
+                std::shared_ptr<Mission> entry(std::make_shared<Mission>());
+                unsigned int crc(0);
+                int pos(0);
+                if ((line[0] != '#') &&
+                    (::sscanf(line, "%" SCNd32 " %" SCNd64 " %x %" SCNx64 " %n",
+                              &entry->size, &entry->mtime, &crc, &entry->hash, &pos) == 4) && (pos > 0))
+                {
+                    std::string name(line + pos);
+                    while (!name.empty() && ((name.back() == '\n') || (name.back() == '\r')))
+                    {
+                        name.pop_back();
+                    }
+                    entry->fileName = directory + name;
+                    entry->crc = static_cast<uint16_t>(crc);
+                    missions[entry->fileName] = entry;
+                }
+            }
+            ::fclose(file);
+        }
+    }
+
+    void MissionStore::writeIndex(std::string const &directory)
+    {
+        if (m_indexDirty.exchange(false))
+        {
+            std::string indexName(directory + kIndexFileName);
+            std::string tempName(indexName + ".tmp");
+            FILE *file(::fopen(tempName.c_str(), "w"));
+            bool ok(file != nullptr);
+
+            if (ok)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                ::fprintf(file, "# size mtime crc hash name\n");
+                for (auto const &entry : m_missions)
+                {
+                    Mission const &mission(*entry.second);
+                    ::fprintf(file, "%" PRId32 " %" PRId64 " %04x %016" PRIx64 " %s\n", mission.size, mission.mtime,
+                              mission.crc, mission.hash, mission.fileName.substr(directory.size()).c_str());
+                }
+                ok = (::fclose(file) == 0);
+            }
+
+            // Replace the index in one step so that a partially written index is never read
+            if (!ok || (::rename(tempName.c_str(), indexName.c_str()) != 0))
+            {
+                log(LOG_WARNING, "failed to write mission index %s", indexName.c_str());
+                m_indexDirty = true;
+            }
+        }
+    }
+
+    std::vector<uint8_t> MissionStore::validateAll(std::vector<std::shared_ptr<Mission>> const &missions)
+    {
+        std::vector<uint8_t> valid(missions.size(), 0);
+
+        if (!missions.empty())
+        {
+            auto start(std::chrono::steady_clock::now());
+            std::atomic<size_t> next(0);
+            std::atomic<uint64_t> numBytes(0);
+            uint32_t numThreads(std::min(std::thread::hardware_concurrency(), uint32_t(kMaxValidationThreads)));
+            numThreads = std::max(1u, std::min(numThreads, uint32_t(missions.size())));
+
+            // Each worker takes the next unvalidated file until there are none left
+            auto worker = [&]()
+            {
+                size_t i;
+                while ((i = next++) < missions.size())
+                {
+                    Mission &mission(*missions[i]);
+                    if (validate(mission.fileName, mission))
+                    {
+                        numBytes += mission.size;
+                        valid[i] = 1;
+                    }
+                }
+            };
+
+            std::vector<std::thread> threads;
+            for (uint32_t i = 1; i < numThreads; ++i)
+            {
+                threads.push_back(std::thread(worker));
+            }
+            worker();
+            for (auto &thread : threads)
+            {
+                thread.join();
+            }
+
+            uint32_t numValid(std::count(valid.begin(), valid.end(), 1));
+            auto elapsed_ms(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count());
+            log(LOG_INFO, "validated %u of %u missions (%" PRIu64 " bytes) in %u ms using %u threads",
+                numValid, uint32_t(missions.size()), uint64_t(numBytes), uint32_t(elapsed_ms), numThreads);
+        }
+
+        return valid;
+    }
+
+    bool MissionStore::validate(std::string const &fileName, Mission &mission)
+    {
+        bool ok(false);
+        FILE *file(::fopen(fileName.c_str(), "rb"));
+        struct stat st;
+
+        if (!file)
+        {
+            log(LOG_WARNING, "failed to open %s", fileName.c_str());
+        }
+        else if (::fstat(::fileno(file), &st) != 0)
+        {
+            log(LOG_ERR, "failed to stat %s", fileName.c_str());
+        }
+        else if (st.st_size <= 0)
+        {
+            log(LOG_WARNING, "empty file %s", fileName.c_str());
+        }
+        else
+        {
+            mission.fileName = fileName;
+            mission.size = static_cast<int32_t>(st.st_size);
+            mission.mtime = modificationTime(st);
+
+            // Get mission CRC before sending as MCM expects the verify CRC command in quick succession
+            // after the last data packet
+            FastCrc16 crc16;
+            uint64_t hash(kHashSeed);
+            int32_t total(0);
+            size_t n(0);
+            uint8_t buffer[1024];
+            while ((n = ::fread(buffer, 1, sizeof(buffer), file)) > 0)
+            {
+                crc16.write(buffer, n);
+                hash = contentHash(buffer, n, hash);
+                total += n;
+            }
+            mission.crc = crc16.read();
+            mission.hash = hash;
+
+            // File may have been truncated or extended whilst it was being read
+            ok = (total == mission.size);
+            if (!ok)
+            {
+                log(LOG_WARNING, "%s changed during validation", fileName.c_str());
+            }
+        }
+
+        if (file)
+        {
+            ::fclose(file);
+        }
+
+        return ok;
+    }
+
+    uint64_t MissionStore::contentHash(const uint8_t *data, size_t size, uint64_t hash)
+    {
+        // 64-bit FNV-1a
+        for (size_t i = 0; i < size; ++i)
+        {
+            hash = (hash ^ data[i]) * 0x100000001b3ull;
+        }
+        return hash;
+    }
+
+    int64_t MissionStore::modificationTime(struct stat const &st)
+    {
+        return (static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000) + st.st_mtim.tv_nsec;
+    }
+}
@@ -0,0 +1,93 @@
+#include "modearbiter.hpp"
+
+namespace sapient
+{
+    bool ModeArbiter::request(uint32_t source, uint32_t mode, int32_t priority, uint32_t expiry_ms, TimePoint now)
+    {
+        bool changed(false);
+
+        if (source < kMaxSources)
+        {
+            // A request for no mode withdraws the source's request, so lower priority sources take over
+            Request &req(m_requests[source]);
+            req.active = (mode != 0);
+            req.mode = mode;
+            req.priority = priority;
+            req.expires = (expiry_ms > 0);
+            req.expiry = now + std::chrono::milliseconds(expiry_ms);
+            changed = update();
+        }
+
+        return changed;
+    }
+
+    bool ModeArbiter::expire(TimePoint now)
+    {
+        bool changed(false);
+
+        // Nothing to do until the earliest request expires
+        if (m_expires && (now >= m_nextExpiry))
+        {
+            for (auto &req : m_requests)
+            {
+                if (req.active && req.expires && (now >= req.expiry))
+                {
+                    req.active = false;
+                }
+            }
+            changed = update();
+        }
+
+        return changed;
+    }
+
+    bool ModeArbiter::nextExpiry(TimePoint &time) const
+    {
+        if (m_expires)
+        {
+            time = m_nextExpiry;
+        }
+        return m_expires;
+    }
+
+    uint32_t ModeArbiter::effectiveMode() const
+    {
+        return m_effectiveMode;
+    }
+
+    bool ModeArbiter::update()
+    {
+        bool found(false);
+        int32_t priority(0);
+        uint32_t mode(0);
+
+        m_expires = false;
+        for (auto const &req : m_requests)
+        {
+            if (req.active)
+            {
+                if (!found || (req.priority > priority))
+                {
+                    found = true;
+                    priority = req.priority;
+                    mode = req.mode;
+                }
+                else if (req.priority == priority)
+                {
+                    mode |= req.mode;
+                }
+
+                if (req.expires && (!m_expires || (req.expiry < m_nextExpiry)))
+                {
+                    m_expires = true;
+                    m_nextExpiry = req.expiry;
+                }
+            }
+        }
+
+        bool changed(mode != m_effectiveMode);
+        m_effectiveMode = mode;
+
+        return changed;
+    }
+}
@@ -0,0 +1,59 @@
+#include "rttestimator.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace sapient
+{
+    RttEstimator::RttEstimator(uint32_t floor_ms, uint32_t ceiling_ms) :
+        m_floor_ms(floor_ms),
+        m_ceiling_ms(ceiling_ms)
+    {
+    }
+
+    uint32_t RttEstimator::timeout_ms() const
+    {
+        uint32_t timeout(m_ceiling_ms);
+
+        if (m_hasSample)
+        {
+            float rto_ms((m_srtt_ms + (4.0f * m_rttvar_ms)) * static_cast<float>(1u << m_backoff));
+            timeout = static_cast<uint32_t>(std::min(std::ceil(rto_ms), static_cast<float>(m_ceiling_ms)));
+            timeout = std::max(timeout, m_floor_ms);
+        }
+
+        return timeout;
+    }
+
+    void RttEstimator::sample(uint32_t rtt_ms)
+    {
+        float rtt(static_cast<float>(rtt_ms));
+
+        if (m_hasSample)
+        {
+            m_rttvar_ms = (0.75f * m_rttvar_ms) + (0.25f * std::fabs(m_srtt_ms - rtt));
+            m_srtt_ms = (0.875f * m_srtt_ms) + (0.125f * rtt);
+        }
+        else
+        {
+            m_srtt_ms = rtt;
+            m_rttvar_ms = rtt / 2.0f;
+            m_hasSample = true;
+        }
+        m_backoff = 0;
+    }
+
+    void RttEstimator::timedOut()
+    {
+        if (m_backoff < kMaxBackoff)
+        {
+            m_backoff++;
+        }
+    }
+
+    void RttEstimator::reset()
+    {
+        m_hasSample = false;
+        m_backoff = 0;
+    }
+}
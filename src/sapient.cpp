@@ -1,5 +1,6 @@
 #include "sapient.hpp"
 #include "sapientmode.hpp"
+#include "jammerstatus.hpp"
 #include "sapientmessage.hpp"
 #include "debuglog.hpp"
 #include "base/baselib/inc/circbuffer.hpp"
@@ -36,6 +37,9 @@ namespace sapient
         char recvBuff[32 * 1024] = {0};
         bool ok(true);
 
+        // Tasks from this SDA are arbitrated against other task sources
+        m_modeSource = SapientMode::instance().addSource("SDA " + ipAddress, SapientMode::kPrioritySda);
+
         while (ok)
         {
             if (connect(ipAddress, port))
@@ -61,6 +65,10 @@ namespace sapient
                             SapientMessageHeartbeat hb;
                             hb.m_sensorId = m_sensorId;
                             hb.m_reportId = m_reportId++;
+                            uint32_t statusRevision(JammerStatus::instance().revision());
+                            hb.m_changed = (statusRevision != m_statusRevision);
+                            m_statusRevision = statusRevision;
+                            hb.m_installStatus = getInstallStatus();
                             sendMessage(hb);
                             lastHeartbeat = now;
                         }
@@ -121,14 +129,20 @@ namespace sapient
                                         {
                                             std::shared_ptr<SapientMessageSensorTask> task = std::dynamic_pointer_cast<SapientMessageSensorTask>(msg);
 
-                                            if (task->m_sensorId == m_sensorId)
+                                            if (task->m_sensorId != m_sensorId)
                                             {
-                                                log(LOG_INFO, "sensor task message received, mode %u", task->m_mode);
-                                                SapientMode::instance().setMode(task->m_mode);
+                                                log(LOG_WARNING, "received task with wrong sensor ID (task %u, ours %u)", task->m_sensorId, m_sensorId);
+                                            }
+                                            else if (task->m_request == kTaskSetCompleteRequest)
+                                            {
+                                                // SDA has sent all of the tasks in this set, latch the mode without waiting
+                                                log(LOG_INFO, "sensor task set complete");
+                                                SapientMode::instance().completeTaskSet(m_modeSource);
                                             }
                                             else
                                             {
-                                                log(LOG_WARNING, "received task with wrong sensor ID (task %u, ours %u)", task->m_sensorId, m_sensorId);
+                                                log(LOG_INFO, "sensor task message received, mode %u", task->m_mode);
+                                                SapientMode::instance().setMode(m_modeSource, task->m_mode);
                                             }
                                         }
                                     }
@@ -239,6 +253,29 @@ namespace sapient
         }
     }
 
+    std::string Sapient::getInstallStatus()
+    {
+        std::string status;
+        uint8_t percent(0);
+        bool etaValid(false);
+        JammerStatus::TimePoint eta;
+
+        if (JammerStatus::instance().getInstallProgress(percent, etaValid, eta))
+        {
+            status = std::to_string(percent) + "% complete";
+            if (etaValid)
+            {
+                char timeBuf[21];
+                time_t etaTime(std::chrono::system_clock::to_time_t(eta));
+                strftime(timeBuf, sizeof(timeBuf), "%FT%TZ", gmtime(&etaTime));
+                status += ", estimated completion ";
+                status += timeBuf;
+            }
+        }
+
+        return status;
+    }
+
     char *Sapient::getIpString(sockaddr *sa, char *s, size_t maxlen)
     {
         // Convert a struct sockaddr address to a string, IPv4 and IPv6:
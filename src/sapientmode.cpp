@@ -1,8 +1,11 @@
 #include "sapientmode.hpp"
+#include "missionstore.hpp"
 #include "debuglog.hpp"
 
+#include <algorithm>
+#include <cctype>
 #include <chrono>
-#include <unistd.h>
+#include <cstdio>
 
 namespace sapient
 {
@@ -12,42 +15,334 @@ namespace sapient
         return s;
     }
 
-    void SapientMode::setMode(int32_t mode)
+    SapientMode::SapientMode()
+        : m_policy(new DebounceAccumulationPolicy(kModeAccumulationTime_ms, kStopAccumulationTime_ms))
     {
-        // If mode is 0 then clear overall mode
-        if (mode == 0)
+        compileModeMap(std::vector<int32_t>(), std::vector<std::string>());
+    }
+
+    bool SapientMode::loadModeMap(std::string const &fileName)
+    {
+        bool ok(true);
+        std::vector<int32_t> modeBits;
+        std::vector<std::string> missionNames;
+        FILE *file(::fopen(fileName.c_str(), "r"));
+
+        if (!file)
+        {
+            log(LOG_INFO, "no mode map %s, using default", fileName.c_str());
+            ok = false;
+        }
+        else
+        {
+            char line[256];
+            uint32_t lineNumber(0);
+            uint32_t debounce_ms(kModeAccumulationTime_ms);
+            uint32_t stopDebounce_ms(kStopAccumulationTime_ms);
+            bool debounceSet(false);
+            while (::fgets(line, sizeof(line), file))
+            {
+                int32_t taskMode(0), bit(0);
+                uint32_t mask(0);
+                int pos(0);
+                ++lineNumber;
+
+                if ((line[0] == '#') || (line[0] == '\n') || (line[0] == '\r'))
+                {
+                    // Comment or empty line
+                }
+                else if (::sscanf(line, "debounce %u", &debounce_ms) == 1)
+                {
+                    log(LOG_INFO, "mode accumulation debounce %u ms", debounce_ms);
+                    debounceSet = true;
+                }
+                else if (::sscanf(line, "stopdebounce %u", &stopDebounce_ms) == 1)
+                {
+                    log(LOG_INFO, "stop debounce %u ms", stopDebounce_ms);
+                    debounceSet = true;
+                }
+                else if (::sscanf(line, "mode %d %d", &taskMode, &bit) == 2)
+                {
+                    if ((taskMode > 0) && (taskMode <= kMaxTaskMode) && (bit >= 0) && (bit < kMaxModeBits))
+                    {
+                        if (int32_t(modeBits.size()) <= taskMode)
+                        {
+                            modeBits.resize(taskMode + 1, -1);
+                        }
+                        modeBits.at(taskMode) = bit;
+                    }
+                    else
+                    {
+                        log(LOG_WARNING, "%s:%u: task mode %d or bit %d out of range", fileName.c_str(), lineNumber, taskMode, bit);
+                        ok = false;
+                    }
+                }
+                else if ((::sscanf(line, "mission %i %n", &mask, &pos) == 1) && (pos > 0))
+                {
+                    std::string name(line + pos);
+                    while (!name.empty() && ::isspace(name.back()))
+                    {
+                        name.pop_back();
+                    }
+
+                    if ((mask < (1u << kMaxModeBits)) && !name.empty())
+                    {
+                        if (missionNames.size() <= mask)
+                        {
+                            missionNames.resize(mask + 1);
+                        }
+                        missionNames.at(mask) = name;
+                    }
+                    else
+                    {
+                        log(LOG_WARNING, "%s:%u: invalid mission mapping", fileName.c_str(), lineNumber);
+                        ok = false;
+                    }
+                }
+                else
+                {
+                    log(LOG_WARNING, "%s:%u: unrecognised line", fileName.c_str(), lineNumber);
+                    ok = false;
+                }
+            }
+            ::fclose(file);
+
+            if (debounceSet)
+            {
+                setPolicy(std::unique_ptr<ModeAccumulationPolicy>(new DebounceAccumulationPolicy(debounce_ms, stopDebounce_ms)));
+            }
+        }
+
+        compileModeMap(modeBits, missionNames);
+
+        return ok;
+    }
+
+    void SapientMode::compileModeMap(std::vector<int32_t> const &modeBits, std::vector<std::string> const &missionNames)
+    {
+        int32_t numBits(0);
+        int32_t numTaskModes(0);
+
+        if (modeBits.empty())
         {
-            m_mode = 0;
+            // Task modes 1 to 7 are the "wideband, omni" modes
+            m_modeBits.assign(kDefaultModeBits + 1, -1);
+            for (int32_t taskMode = 1; taskMode <= kDefaultModeBits; ++taskMode)
+            {
+                m_modeBits.at(taskMode) = taskMode - 1;
+            }
         }
         else
         {
-            // Only decode "wideband, omni" modes for now
-            if (mode <= 7)
+            m_modeBits = modeBits;
+        }
+
+        for (auto bit : m_modeBits)
+        {
+            numBits = std::max(numBits, bit + 1);
+            numTaskModes += (bit >= 0) ? 1 : 0;
+        }
+
+        // Flatten into a table with an entry for every composite mode
+        m_missionNames.assign(1u << numBits, std::string());
+        for (uint32_t mode = 0; mode < m_missionNames.size(); ++mode)
+        {
+            if ((mode < missionNames.size()) && !missionNames.at(mode).empty())
+            {
+                m_missionNames.at(mode) = missionNames.at(mode);
+            }
+            else if (mode < (1u << kDefaultModeBits))
             {
-                m_mode |= 1 << (mode - 1);
+                getDefaultMissionName(mode, m_missionNames.at(mode));
             }
         }
 
-        m_modeSetTime = std::chrono::steady_clock::now();
+        for (uint32_t mode = m_missionNames.size(); mode < missionNames.size(); ++mode)
+        {
+            if (!missionNames.at(mode).empty())
+            {
+                log(LOG_WARNING, "mission %s uses unmapped mode bits (0x%03x)", missionNames.at(mode).c_str(), mode);
+            }
+        }
+
+        log(LOG_INFO, "mode map: %d task modes, %d bits, %u composite modes", numTaskModes, numBits,
+            uint32_t(m_missionNames.size()));
+    }
+
+    uint32_t SapientMode::addSource(std::string const &name, int32_t priority, uint32_t expiry_ms)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        uint32_t id(m_sources.size());
+
+        if (id < ModeArbiter::kMaxSources)
+        {
+            Source source;
+            source.name = name;
+            source.priority = priority;
+            source.expiry_ms = expiry_ms;
+            m_sources.push_back(source);
+            log(LOG_INFO, "added task source %s (priority %d)", name.c_str(), priority);
+        }
+        else
+        {
+            log(LOG_ERR, "too many task sources, ignoring %s", name.c_str());
+        }
+
+        return id;
+    }
+
+    void SapientMode::setMode(uint32_t source, int32_t mode)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if (source < m_sources.size())
+        {
+            Source &src(m_sources[source]);
+
+            // If mode is 0 then clear overall mode
+            if (mode == 0)
+            {
+                src.mode = 0;
+            }
+            else if ((mode > 0) && (mode < int32_t(m_modeBits.size())) && (m_modeBits[mode] >= 0))
+            {
+                src.mode |= 1u << m_modeBits[mode];
+            }
+            else
+            {
+                log(LOG_WARNING, "task mode %d not in mode map", mode);
+            }
+
+            src.modeSetTime = std::chrono::steady_clock::now();
+            if (!src.windowOpen)
+            {
+                src.windowOpen = true;
+                src.windowOpenTime = src.modeSetTime;
+            }
+            src.windowTime_ms = m_policy->windowTime_ms(src.mode, src.taskSetComplete);
+
+            // Wake waiters so that they wait for the new window
+            m_modeChanged.notify_all();
+        }
+    }
+
+    void SapientMode::completeTaskSet(uint32_t source)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if ((source < m_sources.size()) && m_sources[source].windowOpen)
+        {
+            Source &src(m_sources[source]);
+            src.taskSetComplete = true;
+            src.windowTime_ms = m_policy->windowTime_ms(src.mode, src.taskSetComplete);
+            m_modeChanged.notify_all();
+        }
+    }
+
+    void SapientMode::setPolicy(std::unique_ptr<ModeAccumulationPolicy> policy)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_policy = std::move(policy);
     }
 
     int32_t SapientMode::mode()
     {
-        auto now(std::chrono::steady_clock::now());
-        if (std::chrono::duration_cast<std::chrono::milliseconds>(now - m_modeSetTime).count() >= kModeAccumulationTime_ms)
+        std::lock_guard<std::mutex> lock(m_mutex);
+        update(std::chrono::steady_clock::now());
+        return m_arbiter.effectiveMode();
+    }
+
+    uint32_t SapientMode::modeGeneration()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        update(std::chrono::steady_clock::now());
+        return m_modeGeneration;
+    }
+
+    void SapientMode::notifyMissionsChanged()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ++m_modeGeneration;
+        m_modeChanged.notify_all();
+    }
+
+    bool SapientMode::waitForModeChange(uint32_t &generation, uint32_t timeout_ms)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        TimePoint now(std::chrono::steady_clock::now());
+        TimePoint deadline(now + std::chrono::milliseconds(timeout_ms));
+
+        update(now);
+        while ((generation == m_modeGeneration) && (now < deadline))
         {
-            if (m_mode != m_latchedMode)
+            // Wake up in time to latch open windows and drop expired requests
+            TimePoint wakeTime(deadline);
+            TimePoint expiry;
+            for (auto const &src : m_sources)
+            {
+                if (src.windowOpen)
+                {
+                    wakeTime = std::min(wakeTime, src.modeSetTime + std::chrono::milliseconds(src.windowTime_ms));
+                }
+            }
+            if (m_arbiter.nextExpiry(expiry))
             {
-                log(LOG_INFO, "changing composite mode to %u", uint32_t(m_mode));
+                wakeTime = std::min(wakeTime, expiry);
             }
-            m_latchedMode = uint32_t(m_mode);
+
+            m_modeChanged.wait_until(lock, wakeTime);
+            now = std::chrono::steady_clock::now();
+            update(now);
         }
-        return m_latchedMode;
+
+        bool changed(generation != m_modeGeneration);
+        generation = m_modeGeneration;
+
+        return changed;
     }
 
-    bool SapientMode::getMissionName(std::string &name) const
+    void SapientMode::update(TimePoint now)
     {
-        return getMissionName(m_mode, name);
+        // Called with m_mutex held
+        bool changed(false);
+
+        for (uint32_t id = 0; id < m_sources.size(); ++id)
+        {
+            Source &src(m_sources[id]);
+            if (src.windowOpen &&
+                (std::chrono::duration_cast<std::chrono::milliseconds>(now - src.modeSetTime).count() >= src.windowTime_ms))
+            {
+                src.windowOpen = false;
+                src.taskSetComplete = false;
+                changed = m_arbiter.request(id, src.mode, src.priority, src.expiry_ms, now) || changed;
+                recordLatchDelay(src, std::chrono::duration_cast<std::chrono::milliseconds>(now - src.windowOpenTime).count());
+            }
+        }
+
+        changed = m_arbiter.expire(now) || changed;
+
+        // Only wake the waiters when the effective mode really changes
+        if (changed)
+        {
+            log(LOG_INFO, "changing composite mode to %u", m_arbiter.effectiveMode());
+            ++m_modeGeneration;
+            m_modeChanged.notify_all();
+        }
+    }
+
+    void SapientMode::recordLatchDelay(Source const &source, uint32_t delay_ms)
+    {
+        static const uint32_t kBinLimits_ms[kNumLatchDelayBins - 1] = {10, 100, 500, 1000, 1500, 2000};
+        size_t bin(0);
+        while ((bin < (kNumLatchDelayBins - 1)) && (delay_ms >= kBinLimits_ms[bin]))
+        {
+            ++bin;
+        }
+        ++m_latchDelayHistogram.at(bin);
+
+        auto const &h(m_latchDelayHistogram);
+        log(LOG_INFO, "%s mode %u latched after %u ms (histogram <10:%u <100:%u <500:%u <1000:%u <1500:%u <2000:%u >=2000:%u)",
+            source.name.c_str(), source.mode, delay_ms, h[0], h[1], h[2], h[3], h[4], h[5], h[6]);
     }
 
     bool SapientMode::getMissionFileName(uint32_t mode, std::string &name) const
@@ -57,7 +352,32 @@ namespace sapient
         return ok;
     }
 
+    bool SapientMode::getMissionContentId(uint32_t mode, MissionStore::ContentId &id) const
+    {
+        std::string name;
+        return getMissionFileName(mode, name) && MissionStore::instance().getContentId(name, id);
+    }
+
+    bool SapientMode::getMissionContentId(std::string const &name, MissionStore::ContentId &id) const
+    {
+        return MissionStore::instance().getContentId(kMissionFileLocation + name + kMissionSuffix, id);
+    }
+
     bool SapientMode::getMissionName(uint32_t mode, std::string &name) const
+    {
+        bool ok((mode < m_missionNames.size()) && !m_missionNames[mode].empty());
+        if (ok)
+        {
+            name = m_missionNames[mode];
+        }
+        else
+        {
+            name.clear();
+        }
+        return ok;
+    }
+
+    bool SapientMode::getDefaultMissionName(uint32_t mode, std::string &name) const
     {
         bool ok(true);
         uint8_t ecm[5];
@@ -125,16 +445,21 @@ namespace sapient
         return ok;
     }
 
+    std::string const &SapientMode::missionFileLocation() const
+    {
+        return kMissionFileLocation;
+    }
+
     bool SapientMode::doMissionFilesExist() const
     {
         bool ok(true);
 
-        for (uint32_t mode = 0; mode <= 127; ++mode)
+        for (uint32_t mode = 0; mode < m_missionNames.size(); ++mode)
         {
             std::string name;
             if (getMissionFileName(mode, name))
             {
-                if (::access(name.c_str(), F_OK) == -1)
+                if (!MissionStore::instance().hasMission(name))
                 {
                     log(LOG_WARNING, "file not found: %s (mode 0x%02x)", name.c_str(), mode);
                     ok = false;
@@ -142,7 +467,7 @@ namespace sapient
             }
             else
             {
-                log(LOG_ERR, "getMissionName(%u) failed", mode);
+                log(LOG_WARNING, "no mission for mode 0x%02x", mode);
             }
         }
 
@@ -0,0 +1,317 @@
+#include "sharedmissioncache.hpp"
+#include "debuglog.hpp"
+
+#include <cerrno>
+#include <cinttypes>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace sapient
+{
+    SharedMissionCache &SharedMissionCache::instance()
+    {
+        static SharedMissionCache s;
+        return s;
+    }
+
+    bool SharedMissionCache::attach(std::string const &name)
+    {
+        bool ok(false);
+        int fd(::shm_open(name.c_str(), O_RDONLY, 0));
+
+        if (fd < 0)
+        {
+            log(LOG_INFO, "no shared mission cache %s", name.c_str());
+        }
+        else
+        {
+            auto start(std::chrono::steady_clock::now());
+            const uint8_t *base(nullptr);
+            struct stat st;
+            bool keepWaiting(true);
+
+            // The populating process sizes the cache before filling it in and then sets the ready flag
+            while (!ok && keepWaiting)
+            {
+                if (!base && (::fstat(fd, &st) == 0) && (st.st_size >= static_cast<off_t>(sizeof(Header))))
+                {
+                    void *p(::mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0));
+                    if (p != MAP_FAILED)
+                    {
+                        base = static_cast<const uint8_t*>(p);
+                    }
+                }
+
+                // The header is zero until the populating process has written it, the rest of the header is only
+                // checked once the ready flag shows that it is complete
+                if (base)
+                {
+                    const Header *header(reinterpret_cast<const Header*>(base));
+                    bool ready((header->magic != 0) && (header->ready.load() != 0));
+                    if (((header->magic != 0) && (header->magic != kMagic)) ||
+                        (ready && ((header->version != kVersion) || (header->size != static_cast<uint64_t>(st.st_size)))))
+                    {
+                        log(LOG_WARNING, "shared mission cache %s is not compatible", name.c_str());
+                        keepWaiting = false;
+                    }
+                    else
+                    {
+                        ok = ready;
+                    }
+                }
+
+                if (!ok && keepWaiting)
+                {
+                    auto elapsed(std::chrono::steady_clock::now() - start);
+                    keepWaiting = (std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() < kReadyWaitTime_ms);
+                    ::usleep(kReadyPollTime_ms * 1000);
+                }
+            }
+
+            if (ok)
+            {
+                map(base, st.st_size);
+                log(LOG_INFO, "attached shared mission cache %s (%u missions, %u distinct)", name.c_str(),
+                    reinterpret_cast<const Header*>(base)->numEntries, uint32_t(m_contents.size()));
+            }
+            else
+            {
+                if (base)
+                {
+                    ::munmap(const_cast<uint8_t*>(base), st.st_size);
+                }
+                log(LOG_WARNING, "shared mission cache %s not ready", name.c_str());
+            }
+
+            ::close(fd);
+        }
+
+        return ok;
+    }
+
+    bool SharedMissionCache::populate(std::string const &name, std::string const &directory)
+    {
+        bool ok(false);
+        std::vector<MissionStore::MissionPtr> missions;
+        MissionStore::instance().getMissions(missions);
+
+        if (isConsistent(directory, missions))
+        {
+            log(LOG_INFO, "shared mission cache %s is up to date", name.c_str());
+            ok = true;
+        }
+        else
+        {
+            // Only replace a cache which is complete and out of date, one which is missing or which another mediator
+            // has not finished populating is left for the create below to find. Processes which have the stale cache
+            // mapped keep their mapping.
+            if (isAttached())
+            {
+                (void)::shm_unlink(name.c_str());
+            }
+
+            int fd(::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644));
+            if ((fd < 0) && (errno == EEXIST))
+            {
+                // Another mediator started populating the cache first, wait for it to finish
+                ok = attach(name);
+            }
+            else if (fd < 0)
+            {
+                log(LOG_ERR, "failed to create shared mission cache %s (%d)", name.c_str(), errno);
+            }
+            else
+            {
+                // Lay out the header, the entries and then each distinct content once
+                std::map<MissionStore::ContentId, uint64_t> offsets;
+                uint64_t size(align(sizeof(Header)) + align(missions.size() * sizeof(Entry)));
+                for (auto const &mission : missions)
+                {
+                    if (offsets.insert(std::make_pair(mission->contentId(), size)).second)
+                    {
+                        size += align(mission->size);
+                    }
+                }
+
+                void *p(MAP_FAILED);
+                if (::ftruncate(fd, size) == 0)
+                {
+                    p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                }
+
+                if (p == MAP_FAILED)
+                {
+                    log(LOG_ERR, "failed to map shared mission cache %s (%d)", name.c_str(), errno);
+                    (void)::shm_unlink(name.c_str());
+                }
+                else
+                {
+                    uint8_t *base(static_cast<uint8_t*>(p));
+                    Header *header(reinterpret_cast<Header*>(base));
+                    Entry *entries(reinterpret_cast<Entry*>(base + align(sizeof(Header))));
+                    uint32_t numEntries(0);
+
+                    header->magic = kMagic;
+                    header->version = kVersion;
+                    header->ready.store(0);
+                    header->size = size;
+
+                    ok = true;
+                    for (auto const &content : offsets)
+                    {
+                        MissionStore::MissionPtr mission;
+                        ok = ok && MissionStore::instance().getContent(content.first, mission) &&
+                             readContent(*mission, base + content.second);
+                    }
+
+                    for (auto const &mission : missions)
+                    {
+                        std::string fileName(mission->fileName.substr(directory.size()));
+                        if (fileName.size() < kMaxNameLength)
+                        {
+                            Entry &entry(entries[numEntries++]);
+                            ::strncpy(entry.name, fileName.c_str(), sizeof(entry.name));
+                            entry.size = mission->size;
+                            entry.crc = mission->crc;
+                            entry.mtime = mission->mtime;
+                            entry.hash = mission->hash;
+                            entry.offset = offsets[mission->contentId()];
+                        }
+                        else
+                        {
+                            log(LOG_WARNING, "mission name too long for shared cache: %s", fileName.c_str());
+                        }
+                    }
+                    header->numEntries = numEntries;
+
+                    if (ok)
+                    {
+                        header->ready.store(1);
+                        map(base, size);
+                        log(LOG_INFO, "populated shared mission cache %s (%u missions, %u distinct, %" PRIu64 " bytes)",
+                            name.c_str(), numEntries, uint32_t(offsets.size()), size);
+                    }
+                    else
+                    {
+                        // Missions changed whilst being copied. The cache is only populated at start-up so this
+                        // mediator carries on without it, the next mediator to start will try again
+                        log(LOG_WARNING, "failed to populate shared mission cache %s", name.c_str());
+                        ::munmap(p, size);
+                        (void)::shm_unlink(name.c_str());
+                    }
+                }
+
+                ::close(fd);
+            }
+        }
+
+        return ok;
+    }
+
+    bool SharedMissionCache::getMissions(std::string const &directory, std::map<std::string, MissionStore::MissionPtr> &missions)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if (m_base)
+        {
+            const Header *header(reinterpret_cast<const Header*>(m_base));
+            const Entry *entries(reinterpret_cast<const Entry*>(m_base + align(sizeof(Header))));
+            for (uint32_t i = 0; i < header->numEntries; ++i)
+            {
+                std::shared_ptr<MissionStore::Mission> mission(std::make_shared<MissionStore::Mission>());
+                mission->fileName = directory + std::string(entries[i].name);
+                mission->size = entries[i].size;
+                mission->crc = entries[i].crc;
+                mission->mtime = entries[i].mtime;
+                mission->hash = entries[i].hash;
+                missions[mission->fileName] = mission;
+            }
+        }
+
+        return (m_base != nullptr);
+    }
+
+    bool SharedMissionCache::isAttached()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return (m_base != nullptr);
+    }
+
+    bool SharedMissionCache::getContent(MissionStore::ContentId const &id, const uint8_t *&data)
+    {
+        bool ok(false);
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto it(m_contents.find(id));
+        if (it != m_contents.end())
+        {
+            data = m_base + it->second;
+            ok = true;
+        }
+
+        return ok;
+    }
+
+    void SharedMissionCache::map(const uint8_t *base, uint64_t size)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const Header *header(reinterpret_cast<const Header*>(base));
+        const Entry *entries(reinterpret_cast<const Entry*>(base + align(sizeof(Header))));
+
+        m_base = base;
+        m_size = size;
+        m_contents.clear();
+        for (uint32_t i = 0; i < header->numEntries; ++i)
+        {
+            MissionStore::ContentId id;
+            id.hash = entries[i].hash;
+            id.size = entries[i].size;
+            id.crc = entries[i].crc;
+            if ((entries[i].offset + entries[i].size) <= size)
+            {
+                m_contents[id] = entries[i].offset;
+            }
+        }
+    }
+
+    bool SharedMissionCache::isConsistent(std::string const &directory, std::vector<MissionStore::MissionPtr> const &missions)
+    {
+        std::map<std::string, MissionStore::MissionPtr> cached;
+        bool ok(getMissions(directory, cached) && (cached.size() == missions.size()));
+
+        for (auto const &mission : missions)
+        {
+            auto it(cached.find(mission->fileName));
+            ok = ok && (it != cached.end()) && (it->second->mtime == mission->mtime) &&
+                 (it->second->contentId() == mission->contentId());
+        }
+
+        return ok;
+    }
+
+    bool SharedMissionCache::readContent(MissionStore::Mission const &mission, uint8_t *data)
+    {
+        bool ok(false);
+        FILE *file(::fopen(mission.fileName.c_str(), "rb"));
+
+        if (file)
+        {
+            // Only cache content which still matches the validated entry
+            ok = (::fread(data, 1, mission.size, file) == static_cast<size_t>(mission.size)) &&
+                 (MissionStore::contentHash(data, mission.size) == mission.hash);
+            ::fclose(file);
+        }
+
+        return ok;
+    }
+
+    uint64_t SharedMissionCache::align(uint64_t offset)
+    {
+        return (offset + 7) & ~uint64_t(7);
+    }
+}
@@ -0,0 +1,94 @@
+#include "targetinfocache.hpp"
+#include "board.hpp"
+
+namespace sapient
+{
+    void TargetInfoCache::reset()
+    {
+        m_versionValid = false;
+        invalidate();
+    }
+
+    void TargetInfoCache::invalidate()
+    {
+        m_stateValid = false;
+        m_missionNameValid = false;
+    }
+
+    bool TargetInfoCache::getVersion(mercury::embedded::base::Version &version)
+    {
+        if (m_versionValid)
+        {
+            version = m_version;
+        }
+        return count(m_versionValid);
+    }
+
+    void TargetInfoCache::setVersion(mercury::embedded::base::Version const &version)
+    {
+        m_version = version;
+        m_versionValid = true;
+    }
+
+    bool TargetInfoCache::getState(mercury::embedded::system::McmState::State &state)
+    {
+        bool hit(isFresh(m_stateValid, m_stateTime, kStateTtl_ms));
+        if (hit)
+        {
+            state = m_state;
+        }
+        return count(hit);
+    }
+
+    void TargetInfoCache::setState(mercury::embedded::system::McmState::State state)
+    {
+        m_state = state;
+        m_stateValid = true;
+        m_stateTime = mercury::embedded::board::systemTimeMs();
+    }
+
+    bool TargetInfoCache::getMissionName(std::string &name)
+    {
+        bool hit(isFresh(m_missionNameValid, m_missionNameTime, kMissionNameTtl_ms));
+        if (hit)
+        {
+            name = m_missionName;
+        }
+        return count(hit);
+    }
+
+    void TargetInfoCache::setMissionName(std::string const &name)
+    {
+        m_missionName = name;
+        m_missionNameValid = true;
+        m_missionNameTime = mercury::embedded::board::systemTimeMs();
+    }
+
+    uint32_t TargetInfoCache::hits() const
+    {
+        return m_hits;
+    }
+
+    uint32_t TargetInfoCache::misses() const
+    {
+        return m_misses;
+    }
+
+    bool TargetInfoCache::count(bool hit)
+    {
+        if (hit)
+        {
+            m_hits++;
+        }
+        else
+        {
+            m_misses++;
+        }
+        return hit;
+    }
+
+    bool TargetInfoCache::isFresh(bool valid, uint32_t time, uint32_t ttl_ms)
+    {
+        return valid && ((mercury::embedded::board::systemTimeMs() - time) <= ttl_ms);
+    }
+}
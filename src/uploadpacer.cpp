@@ -0,0 +1,94 @@
+#include "uploadpacer.hpp"
+#include "debuglog.hpp"
+
+#include <algorithm>
+
+namespace sapient
+{
+    void UploadPacer::begin(mercury::embedded::base::Version const &version, uint32_t maxWindow)
+    {
+        m_key = key(version);
+        m_maxWindow = std::max(maxWindow, 1u);
+        m_acknowledged = 0;
+
+        auto it(m_stable.find(m_key));
+        if (it != m_stable.end())
+        {
+            m_rate = it->second;
+            m_rate.window = std::min(m_rate.window, m_maxWindow);
+        }
+        else
+        {
+            m_rate.window = m_maxWindow;
+            m_rate.delay_ms = 0;
+        }
+
+        log(LOG_INFO, "upload pacing: window %u, delay %u ms", m_rate.window, m_rate.delay_ms);
+    }
+
+    void UploadPacer::acknowledged()
+    {
+        // Additive increase: one step per interval of consecutive acknowledgements
+        if (++m_acknowledged >= kIncreaseInterval)
+        {
+            m_acknowledged = 0;
+            if (m_rate.delay_ms > 0)
+            {
+                m_rate.delay_ms--;
+            }
+            else if (m_rate.window < m_maxWindow)
+            {
+                m_rate.window++;
+            }
+        }
+    }
+
+    void UploadPacer::failed()
+    {
+        // Multiplicative decrease
+        m_acknowledged = 0;
+        if (m_rate.window > 1)
+        {
+            m_rate.window /= 2;
+        }
+        else
+        {
+            m_rate.delay_ms = std::min(std::max(m_rate.delay_ms * 2, 1u), uint32_t(kMaxDelay_ms));
+        }
+
+        log(LOG_INFO, "upload pacing backed off: window %u, delay %u ms", m_rate.window, m_rate.delay_ms);
+    }
+
+    void UploadPacer::completed(bool success)
+    {
+        if (success)
+        {
+            m_stable[m_key] = m_rate;
+        }
+        else
+        {
+            // Do not start the next upload at a rate which has just failed
+            auto it(m_stable.find(m_key));
+            if (it != m_stable.end())
+            {
+                it->second = m_rate;
+            }
+        }
+    }
+
+    uint32_t UploadPacer::window() const
+    {
+        return m_rate.window;
+    }
+
+    uint32_t UploadPacer::delay_ms() const
+    {
+        return m_rate.delay_ms;
+    }
+
+    uint64_t UploadPacer::key(mercury::embedded::base::Version const &version)
+    {
+        return (static_cast<uint64_t>(version.m_major) << 32) | (static_cast<uint64_t>(version.m_minor) << 16) |
+               static_cast<uint64_t>(version.m_build);
+    }
+}